@@ -0,0 +1,200 @@
+#pragma once
+
+#include "instructioncache.h"
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+class Soft80;
+
+struct BasicBlock {
+
+	using NativeCode = void (*)(Soft80&);
+
+	uint16_t start{ 0 };
+	uint16_t end{ 0 };
+
+	std::vector<CachedInstruction> instructions;
+
+	bool valid{ true };
+
+	NativeCode native{ nullptr };
+	bool compiled{ false };
+
+	std::array<BasicBlock*, 2> links{ nullptr, nullptr };
+
+	BasicBlock* successor(uint16_t address) {
+		for (BasicBlock* link : links) {
+			if (link && link->valid && link->start == address) {
+				return link;
+			}
+		}
+
+		return nullptr;
+	}
+
+	void link(BasicBlock* next) {
+		links[next->start == end ? 0 : 1] = next;
+	}
+
+	static bool is_terminator(const Instruction& instruction) {
+		switch (instruction.name) {
+		case Instruction::Names::CALL:
+		case Instruction::Names::DJNZ:
+		case Instruction::Names::EI:
+		case Instruction::Names::HALT:
+		case Instruction::Names::JP:
+		case Instruction::Names::JR:
+		case Instruction::Names::RET:
+		case Instruction::Names::RETI:
+		case Instruction::Names::RETN:
+		case Instruction::Names::RST:
+		case Instruction::Names::CPDR:
+		case Instruction::Names::CPIR:
+		case Instruction::Names::INDR:
+		case Instruction::Names::INIR:
+		case Instruction::Names::LDDR:
+		case Instruction::Names::LDIR:
+		case Instruction::Names::OTDR:
+		case Instruction::Names::OTIR:
+			return true;
+		default:
+			break;
+		}
+
+		return false;
+	}
+
+};
+
+// A block translated ahead of time. It is only used when the block built
+// at run time covers the same range and memory still holds the same bytes.
+struct StaticBlock {
+	uint16_t start;
+	uint16_t end;
+	const uint8_t* bytes;
+	BasicBlock::NativeCode code;
+};
+
+class BlockCache {
+
+public:
+
+	static const size_t MaxInstructions = 64;
+
+	BasicBlock* lookup(uint16_t address) {
+		auto& page = pages[address / PageSize];
+
+		if (!page) {
+			return nullptr;
+		}
+
+		return (*page)[address % PageSize];
+	}
+
+	BasicBlock* insert(std::unique_ptr<BasicBlock> block) {
+		auto& page = pages[block->start / PageSize];
+
+		if (!page) {
+			page = std::make_unique<Page>();
+		}
+
+		BasicBlock* ret = block.get();
+
+		(*page)[block->start % PageSize] = ret;
+
+		uint16_t last = static_cast<uint16_t>(block->end - 1);
+
+		for (uint16_t p = block->start / PageSize; ; p = (p + 1) % PageCount) {
+			page_blocks[p].push_back(ret);
+
+			if (p == last / PageSize) {
+				break;
+			}
+		}
+
+		blocks.push_back(std::move(block));
+
+		return ret;
+	}
+
+	// Retires every block with code in a page touched by [low, high]. Retired
+	// blocks stay allocated, since the block being executed or links from
+	// other blocks may still point at them, until collect() runs.
+	void invalidate(uint16_t low, uint16_t high) {
+		for (uint16_t p = low / PageSize; ; p = (p + 1) % PageCount) {
+			for (BasicBlock* block : page_blocks[p]) {
+				if (block->valid) {
+					block->valid = false;
+
+					(*pages[block->start / PageSize])[block->start % PageSize] = nullptr;
+
+					retired_count++;
+				}
+			}
+
+			page_blocks[p].clear();
+
+			if (p == high / PageSize) {
+				break;
+			}
+		}
+	}
+
+	// Frees retired blocks. Must only be called between blocks.
+	void collect() {
+		if (retired_count < CollectThreshold) {
+			return;
+		}
+
+		for (auto& page : page_blocks) {
+			std::erase_if(page, [](BasicBlock* block) {
+				return !block->valid;
+			});
+		}
+
+		std::erase_if(blocks, [](const std::unique_ptr<BasicBlock>& block) {
+			return !block->valid;
+		});
+
+		for (auto& block : blocks) {
+			block->links = { nullptr, nullptr };
+		}
+
+		retired_count = 0;
+	}
+
+	// Forgets all compiled code, for when the code buffer is recycled.
+	void drop_native_code() {
+		for (auto& block : blocks) {
+			block->native = nullptr;
+			block->compiled = false;
+		}
+	}
+
+	void clear() {
+		invalidate(0x0000, 0xFFFF);
+
+		retired_count = CollectThreshold;
+
+		collect();
+	}
+
+private:
+
+	static const size_t PageSize = 256;
+	static const size_t PageCount = 0x10000 / PageSize;
+	static const size_t CollectThreshold = 256;
+
+	using Page = std::array<BasicBlock*, PageSize>;
+
+	std::array<std::unique_ptr<Page>, PageCount> pages;
+	std::array<std::vector<BasicBlock*>, PageCount> page_blocks;
+
+	std::vector<std::unique_ptr<BasicBlock>> blocks;
+
+	size_t retired_count{ 0 };
+
+};
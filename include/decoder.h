@@ -6,18 +6,11 @@
 #include <cstdint>
 
 struct Opcode {
-	uint8_t x : 2;
-
-	union {
-		uint8_t y : 3;
-
-		struct {
-			uint8_t q : 1;
-			uint8_t p : 2;
-		};
-	};
-
-	uint8_t z : 3;
+	uint8_t x;
+	uint8_t y;
+	uint8_t z;
+	uint8_t p;
+	uint8_t q;
 };
 
 constexpr Opcode parse_opcode(uint8_t b) {
@@ -26,6 +19,8 @@ constexpr Opcode parse_opcode(uint8_t b) {
 	ret.x = (b & 0b11000000) >> 6;
 	ret.y = (b & 0b00111000) >> 3;
 	ret.z = (b & 0b00000111);
+	ret.p = ret.y >> 1;
+	ret.q = ret.y & 1;
 
 	return ret;
 }
@@ -67,6 +62,34 @@ struct Instruction {
 
 };
 
+// How an operand is reached, whichever register it names.
+enum class OperandKind {
+	None,
+	Register,	// 8-bit register
+	Pair,		// 16-bit register
+	Immediate,
+	Indirect,	// Memory at a register pair plus the displacement
+	Absolute	// Memory at the immediate
+};
+
+constexpr OperandKind operand_kind(RegisterFile::Names name, bool address) {
+
+	switch (name) {
+	case RegisterFile::Names::None:
+		return OperandKind::None;
+	case RegisterFile::Names::Immediate:
+		return address ? OperandKind::Absolute : OperandKind::Immediate;
+	default:
+		break;
+	}
+
+	if (address) {
+		return OperandKind::Indirect;
+	}
+
+	return RegisterFile::is_16bit(name) ? OperandKind::Pair : OperandKind::Register;
+}
+
 constexpr RegisterFile::Names get_alt_name(RegisterFile::Names r) {
 
 	switch (r) {
@@ -82,6 +105,7 @@ constexpr RegisterFile::Names get_alt_name(RegisterFile::Names r) {
 	case RegisterFile::Names::BC: return RegisterFile::Names::BCalt;
 	case RegisterFile::Names::DE: return RegisterFile::Names::DEalt;
 	case RegisterFile::Names::HL: return RegisterFile::Names::HLalt;
+	default: break;
 	}
 
 	return RegisterFile::Names::Immediate;
@@ -101,12 +125,13 @@ constexpr Instruction::Names get_alt_CB_name(Instruction::Names i) {
 	case Instruction::Names::BIT: return Instruction::Names::BIT;
 	case Instruction::Names::RES: return Instruction::Names::RESalt;
 	case Instruction::Names::SET: return Instruction::Names::SETalt;
+	default: break;
 	}
 
 	return i;
 }
 
-const RegisterFile::Names rTable[]{
+constexpr RegisterFile::Names rTable[]{
 	RegisterFile::Names::B,
 	RegisterFile::Names::C,
 	RegisterFile::Names::D,
@@ -117,21 +142,21 @@ const RegisterFile::Names rTable[]{
 	RegisterFile::Names::A
 };
 
-const RegisterFile::Names rpTable[]{
+constexpr RegisterFile::Names rpTable[]{
 	RegisterFile::Names::BC,
 	RegisterFile::Names::DE,
 	RegisterFile::Names::HL,
 	RegisterFile::Names::SP
 };
 
-const RegisterFile::Names rp2Table[]{
+constexpr RegisterFile::Names rp2Table[]{
 	RegisterFile::Names::BC,
 	RegisterFile::Names::DE,
 	RegisterFile::Names::HL,
 	RegisterFile::Names::AF
 };
 
-const Instruction::Conditions ccTable[]{
+constexpr Instruction::Conditions ccTable[]{
 	Instruction::Conditions::NZ,
 	Instruction::Conditions::Z,
 	Instruction::Conditions::NC,
@@ -142,7 +167,7 @@ const Instruction::Conditions ccTable[]{
 	Instruction::Conditions::M
 };
 
-const Instruction::Names aluTable[]{
+constexpr Instruction::Names aluTable[]{
 	Instruction::Names::ADD,
 	Instruction::Names::ADC,
 	Instruction::Names::SUB,
@@ -153,7 +178,7 @@ const Instruction::Names aluTable[]{
 	Instruction::Names::CP
 };
 
-const Instruction::Names rotTable[]{
+constexpr Instruction::Names rotTable[]{
 	Instruction::Names::RLC,
 	Instruction::Names::RRC,
 	Instruction::Names::RL,
@@ -164,30 +189,80 @@ const Instruction::Names rotTable[]{
 	Instruction::Names::SRL
 };
 
-const Instruction::Names bliTable[4][4]{
+constexpr Instruction::Names bliTable[4][4]{
 	{ Instruction::Names::LDI, Instruction::Names::CPI, Instruction::Names::INI, Instruction::Names::OUTI },
 	{ Instruction::Names::LDD, Instruction::Names::CPD, Instruction::Names::IND, Instruction::Names::OUTD },
 	{ Instruction::Names::LDIR, Instruction::Names::CPIR, Instruction::Names::INIR, Instruction::Names::OTIR },
 	{ Instruction::Names::LDDR, Instruction::Names::CPDR, Instruction::Names::INDR, Instruction::Names::OTDR }
 };
 
+// What a single byte means in one opcode space. The entries themselves
+// are built in decodetable.h.
+struct DecodeEntry {
+
+	enum class Space {
+		Main,
+		CB,
+		ED,
+		DD,
+		FD,
+		DDCB,
+		FDCB
+	};
+
+	static const size_t SpaceCount = 7;
+
+	Instruction instruction;
+
+	// Prefix bytes only move the decoder to another space.
+	bool is_prefix{ false };
+
+	// The space in effect after this byte. A DD or FD followed by another
+	// prefix stays in effect for the next byte.
+	Space next{ Space::Main };
+
+	// A displacement byte follows the opcode; it comes before any immediate.
+	// In DDCB and FDCB it has already been read when the opcode is looked up.
+	bool needs_displacement{ false };
+	uint8_t immediate_bytes{ 0 };
+
+	// Bytes from the first prefix to the last immediate.
+	uint8_t length{ 0 };
+
+	// T-states this core charges for the instruction.
+	struct Timing {
+		// Unconditional, not taken, or the last iteration of a block
+		// instruction.
+		uint8_t base{ 0 };
+
+		// The condition was met.
+		uint8_t taken{ 0 };
+
+		// A block instruction that goes round again. It fetches itself anew,
+		// so this is the same as base.
+		uint8_t repeat{ 0 };
+	};
+
+	Timing timing;
+
+};
+
 class Decoder {
 
 public:
 
 	std::optional<Instruction> decode(uint8_t b);
 
-private:
+	bool is_idle() const;
 
-	std::optional<Instruction> decode_CB(uint8_t b);
-	std::optional<Instruction> decode_ED(uint8_t b);
-	std::optional<Instruction> decode_DDFD(uint8_t b);
-	std::optional<Instruction> decode_alt_prefix(uint8_t b);
+	// Timing of the instruction decode last returned.
+	DecodeEntry::Timing timing() const;
 
-	uint16_t prefix{ 0 };
+	static DecodeEntry::Timing timing_of(const Instruction& instruction, uint8_t length);
 
-	bool alt_op{ false };
-	RegisterFile::Names alt_reg{ RegisterFile::Names::None };
+private:
+
+	DecodeEntry::Space space{ DecodeEntry::Space::Main };
 
 	bool needs_displacement{ false };
 	uint8_t immediate_bytes{ 0 };
@@ -195,4 +270,11 @@ private:
 
 	Instruction instruction_progress;
 
+	DecodeEntry::Timing timing_progress;
+	uint8_t length_progress{ 0 };
+	uint8_t bytes_decoded{ 0 };
+	DecodeEntry::Timing last_timing;
+
+	void finish_timing();
+
 };
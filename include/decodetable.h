@@ -0,0 +1,686 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <array>
+#include <cstdint>
+
+// Every opcode of every prefix space, described once at compile time.
+// Decoder walks these tables a byte at a time and the execution tiers can
+// consult them directly.
+namespace DecodeTable {
+
+	using Names = Instruction::Names;
+	using Regs = RegisterFile::Names;
+	using Space = DecodeEntry::Space;
+
+	constexpr bool is_io(Names name) {
+		switch (name) {
+		case Names::IND:
+		case Names::INDR:
+		case Names::INI:
+		case Names::INIR:
+		case Names::OTDR:
+		case Names::OTIR:
+		case Names::OUT:
+		case Names::OUTD:
+		case Names::OUTI:
+			return true;
+		default:
+			break;
+		}
+
+		return false;
+	}
+
+	// Four T-states per fetched byte, three per memory access and four per
+	// I/O access, in the order the interpreter performs them.
+	constexpr DecodeEntry::Timing timing(const Instruction& i, uint8_t length) {
+		uint32_t t = 4 * length;
+
+		if (i.addr_dest) {
+			t += 3;
+		}
+
+		if (i.addr_source) {
+			t += 3;
+		}
+
+		switch (i.name) {
+		case Names::IN:
+		case Names::OUT:
+			t += 4;
+			break;
+		case Names::IND:
+		case Names::INDR:
+		case Names::INI:
+		case Names::INIR:
+		case Names::OTDR:
+		case Names::OTIR:
+		case Names::OUTD:
+		case Names::OUTI:
+			t += 7;
+			break;
+		case Names::LDD:
+		case Names::LDDR:
+		case Names::LDI:
+		case Names::LDIR:
+		case Names::POP:
+		case Names::PUSH:
+		case Names::RETI:
+		case Names::RETN:
+		case Names::RST:
+			t += 6;
+			break;
+		case Names::CALL:
+		case Names::RET:
+			if (i.condition == Instruction::Conditions::None) {
+				t += 6;
+			}
+			break;
+		case Names::CPD:
+		case Names::CPDR:
+		case Names::CPI:
+		case Names::CPIR:
+		case Names::RLD:
+		case Names::RRD:
+			t += 3;
+			break;
+		case Names::RES:
+		case Names::SET:
+		case Names::RESalt:
+		case Names::SETalt:
+			if (i.addr_source) {
+				t += 3;
+			}
+			break;
+		default:
+			break;
+		}
+
+		// Write-back of the result.
+		if (!is_io(i.name) && i.addr_dest) {
+			t += 3;
+		}
+
+		DecodeEntry::Timing ret;
+
+		ret.base = static_cast<uint8_t>(t);
+		ret.taken = ret.base;
+		ret.repeat = ret.base;
+
+		// A taken CALL pushes and a taken RET pops the return address.
+		bool conditional = i.condition != Instruction::Conditions::None;
+
+		if (conditional && (i.name == Names::CALL || i.name == Names::RET)) {
+			ret.taken += 6;
+		}
+
+		return ret;
+	}
+
+	constexpr DecodeEntry main_x0(Opcode o) {
+		DecodeEntry e;
+		Instruction& i = e.instruction;
+
+		switch (o.z) {
+		case 0:
+			switch (o.y) {
+			case 0:
+				i.name = Names::NOP;
+				break;
+			case 1:
+				i.name = Names::EX;
+				i.dest = Regs::A;
+				i.source = get_alt_name(Regs::A);
+				break;
+			case 2:
+				i.name = Names::DJNZ;
+				e.needs_displacement = true;
+				break;
+			case 3:
+				i.name = Names::JR;
+				e.needs_displacement = true;
+				break;
+			default:
+				i.name = Names::JR;
+				i.condition = ccTable[o.y - 4];
+				e.needs_displacement = true;
+				break;
+			}
+			break;
+
+		case 1:
+			if (o.q == 0) {
+				i.name = Names::LD;
+				i.dest = rpTable[o.p];
+				i.source = Regs::Immediate;
+				e.immediate_bytes = 2;
+			}
+			else {
+				i.name = Names::ADD;
+				i.dest = Regs::HL;
+				i.source = rpTable[o.p];
+			}
+			break;
+
+		case 2:
+		{
+			// All four forms take two immediate bytes, even (BC) and (DE).
+			const Regs pointers[]{ Regs::BC, Regs::DE, Regs::Immediate, Regs::Immediate };
+			const Regs registers[]{ Regs::A, Regs::A, Regs::HL, Regs::A };
+
+			i.name = Names::LD;
+			e.immediate_bytes = 2;
+
+			if (o.q == 0) {
+				i.dest = pointers[o.p];
+				i.addr_dest = true;
+				i.source = registers[o.p];
+			}
+			else {
+				i.dest = registers[o.p];
+				i.source = pointers[o.p];
+				i.addr_source = true;
+			}
+			break;
+		}
+
+		case 3:
+			i.name = o.q == 0 ? Names::INC : Names::DEC;
+			i.dest = rpTable[o.p];
+			break;
+
+		case 4:
+			i.name = Names::INC;
+			i.dest = rTable[o.y];
+			break;
+
+		case 5:
+			i.name = Names::DEC;
+			i.dest = rTable[o.y];
+			break;
+
+		case 6:
+			i.name = Names::LD;
+			i.dest = rTable[o.y];
+			i.source = Regs::Immediate;
+			e.immediate_bytes = 1;
+			break;
+
+		case 7:
+		{
+			const Names names[]{
+				Names::RLCA, Names::RRCA, Names::RLA, Names::RRA,
+				Names::DAA, Names::CPL, Names::SCF, Names::CCF
+			};
+
+			i.name = names[o.y];
+			i.dest = Regs::A;
+			break;
+		}
+		}
+
+		return e;
+	}
+
+	constexpr DecodeEntry main_x3(Opcode o) {
+		DecodeEntry e;
+		Instruction& i = e.instruction;
+
+		switch (o.z) {
+		case 0:
+			i.name = Names::RET;
+			i.condition = ccTable[o.y];
+			break;
+
+		case 1:
+			if (o.q == 0) {
+				i.name = Names::POP;
+				i.dest = rp2Table[o.p];
+			}
+			else {
+				switch (o.p) {
+				case 0:
+					i.name = Names::RET;
+					break;
+				case 1:
+					i.name = Names::EXX;
+					break;
+				case 2:
+					i.name = Names::JP;
+					i.dest = Regs::HL;
+					i.addr_dest = true;
+					break;
+				case 3:
+					i.name = Names::LD;
+					i.dest = Regs::SP;
+					i.source = Regs::HL;
+					break;
+				}
+			}
+			break;
+
+		case 2:
+			i.name = Names::JP;
+			i.condition = ccTable[o.y];
+			i.dest = Regs::Immediate;
+			i.addr_dest = true;
+			e.immediate_bytes = 2;
+			break;
+
+		case 3:
+			switch (o.y) {
+			case 0:
+				i.name = Names::JP;
+				i.dest = Regs::Immediate;
+				i.addr_dest = true;
+				e.immediate_bytes = 2;
+				break;
+			case 2:
+				i.name = Names::OUT;
+				i.dest = Regs::Immediate;
+				i.addr_dest = true;
+				i.source = Regs::A;
+				e.immediate_bytes = 1;
+				break;
+			case 3:
+				i.name = Names::IN;
+				i.dest = Regs::A;
+				i.source = Regs::Immediate;
+				i.addr_source = true;
+				e.immediate_bytes = 1;
+				break;
+			case 4:
+				i.name = Names::EX;
+				i.dest = Regs::SP;
+				i.addr_dest = true;
+				i.source = Regs::HL;
+				break;
+			case 5:
+				i.name = Names::EX;
+				i.dest = Regs::DE;
+				i.source = Regs::HL;
+				break;
+			case 6:
+				i.name = Names::DI;
+				break;
+			case 7:
+				i.name = Names::EI;
+				break;
+			}
+			break;
+
+		case 4:
+			i.name = Names::CALL;
+			i.condition = ccTable[o.y];
+			i.dest = Regs::Immediate;
+			i.addr_dest = true;
+			e.immediate_bytes = 2;
+			break;
+
+		case 5:
+			if (o.q == 0) {
+				i.name = Names::PUSH;
+				i.source = rp2Table[o.p];
+			}
+			else if (o.p == 0) {
+				i.name = Names::CALL;
+				i.dest = Regs::Immediate;
+				e.immediate_bytes = 2;
+			}
+			break;
+
+		case 6:
+			i.name = aluTable[o.y];
+			i.condition = ccTable[o.y];
+			i.dest = Regs::A;
+			i.source = Regs::Immediate;
+			e.immediate_bytes = 1;
+			break;
+
+		case 7:
+			i.name = Names::RST;
+			i.dest = Regs::Immediate;
+			i.imm = o.y * 8;
+			break;
+		}
+
+		return e;
+	}
+
+	// An unprefixed opcode, including the prefix bytes themselves.
+	constexpr DecodeEntry main_entry(uint8_t b) {
+		DecodeEntry e;
+
+		switch (b) {
+		case 0xCB:
+			e.is_prefix = true;
+			e.next = Space::CB;
+			return e;
+		case 0xDD:
+			e.is_prefix = true;
+			e.next = Space::DD;
+			return e;
+		case 0xED:
+			e.is_prefix = true;
+			e.next = Space::ED;
+			return e;
+		case 0xFD:
+			e.is_prefix = true;
+			e.next = Space::FD;
+			return e;
+		}
+
+		Opcode o = parse_opcode(b);
+
+		switch (o.x) {
+		case 0:
+			e = main_x0(o);
+			break;
+		case 1:
+			// LD r,(HL) is left as a NOP.
+			if (o.z != 6) {
+				e.instruction.name = Names::LD;
+				e.instruction.dest = rTable[o.y];
+				e.instruction.source = rTable[o.z];
+			}
+			else if (o.y == 6) {
+				e.instruction.name = Names::HALT;
+			}
+			break;
+		case 2:
+			e.instruction.name = aluTable[o.y];
+			e.instruction.dest = Regs::A;
+			e.instruction.source = rTable[o.z];
+			break;
+		case 3:
+			e = main_x3(o);
+			break;
+		}
+
+		return e;
+	}
+
+	constexpr DecodeEntry cb_entry(uint8_t b) {
+		Opcode o = parse_opcode(b);
+
+		DecodeEntry e;
+		Instruction& i = e.instruction;
+
+		if (o.x == 0) {
+			i.name = rotTable[o.y];
+			i.dest = rTable[o.z];
+		}
+		else {
+			const Names names[]{ Names::BIT, Names::RES, Names::SET };
+
+			i.name = names[o.x - 1];
+			i.dest = Regs::Immediate;
+			i.imm = o.y;
+			i.source = rTable[o.z];
+		}
+
+		return e;
+	}
+
+	constexpr DecodeEntry ed_x1(Opcode o) {
+		DecodeEntry e;
+		Instruction& i = e.instruction;
+
+		switch (o.z) {
+		case 0:
+			i.name = Names::IN;
+			i.dest = o.y != 6 ? rTable[o.y] : Regs::None;
+			i.source = Regs::BC;
+			i.addr_source = true;
+			break;
+
+		case 1:
+			i.name = Names::OUT;
+			i.dest = Regs::BC;
+			i.addr_dest = true;
+			i.source = o.y != 6 ? rTable[o.y] : Regs::None;
+			break;
+
+		case 2:
+			i.name = o.q == 0 ? Names::SBC : Names::ADC;
+			i.dest = Regs::HL;
+			i.source = rpTable[o.p];
+			break;
+
+		case 3:
+			i.name = Names::LD;
+			e.immediate_bytes = 2;
+
+			if (o.q == 0) {
+				i.dest = Regs::Immediate;
+				i.addr_dest = true;
+				i.source = rpTable[o.p];
+			}
+			else {
+				i.dest = rpTable[o.p];
+				i.source = Regs::Immediate;
+				i.addr_source = true;
+			}
+			break;
+
+		case 4:
+			i.name = Names::NEG;
+			break;
+
+		case 5:
+			i.name = o.y != 1 ? Names::RETN : Names::RETI;
+			break;
+
+		case 6:
+			i.name = Names::IM;
+			i.dest = Regs::Immediate;
+			i.imm = o.y;
+			break;
+
+		case 7:
+		{
+			const Regs dests[]{ Regs::I, Regs::R, Regs::A, Regs::A };
+			const Regs sources[]{ Regs::A, Regs::A, Regs::I, Regs::R };
+
+			if (o.y < 4) {
+				i.name = Names::LD;
+				i.dest = dests[o.y];
+				i.source = sources[o.y];
+			}
+			else if (o.y == 4) {
+				i.name = Names::RRD;
+			}
+			else if (o.y == 5) {
+				i.name = Names::RLD;
+			}
+			else {
+				i.name = Names::NOP;
+			}
+			break;
+		}
+		}
+
+		return e;
+	}
+
+	constexpr DecodeEntry ed_entry(uint8_t b) {
+		Opcode o = parse_opcode(b);
+
+		if (o.x == 1) {
+			return ed_x1(o);
+		}
+
+		DecodeEntry e;
+
+		if (o.x == 2 && o.z <= 3 && o.y >= 4) {
+			e.instruction.name = bliTable[o.y - 4][o.z];
+		}
+		else {
+			e.instruction.name = Names::NONI;
+		}
+
+		return e;
+	}
+
+	// DD and FD only rename HL, H and L in forms that take further bytes;
+	// one-byte forms such as INC HL run unchanged. FD maps L to IXL.
+	constexpr DecodeEntry index_entry(uint8_t b, bool iy) {
+		DecodeEntry e;
+
+		Space self = iy ? Space::FD : Space::DD;
+
+		switch (b) {
+		case 0xDD:
+		case 0xED:
+		case 0xFD:
+			e.instruction.name = Names::NONI;
+			e.next = self;
+			return e;
+		case 0xCB:
+			e.is_prefix = true;
+			e.next = iy ? Space::FDCB : Space::DDCB;
+			return e;
+		}
+
+		e = main_entry(b);
+
+		if (!e.needs_displacement && e.immediate_bytes == 0) {
+			return e;
+		}
+
+		Instruction& i = e.instruction;
+
+		Regs full = iy ? Regs::IY : Regs::IX;
+		Regs high = iy ? Regs::IYH : Regs::IXH;
+		Regs low = Regs::IXL;
+
+		if (i.source == Regs::HL && i.addr_source) {
+			i.source = full;
+			e.needs_displacement = true;
+		}
+		else if (i.dest == Regs::HL && i.addr_dest) {
+			i.dest = full;
+			e.needs_displacement = true;
+		}
+		else {
+			if (i.source == Regs::HL && i.name != Names::EX && i.dest != Regs::DE) {
+				i.source = full;
+			}
+
+			if (i.dest == Regs::HL) {
+				i.dest = full;
+			}
+
+			if (i.source == Regs::H) {
+				i.source = high;
+			}
+
+			if (i.dest == Regs::H) {
+				i.dest = high;
+			}
+
+			if (i.source == Regs::L) {
+				i.source = low;
+			}
+
+			if (i.dest == Regs::L) {
+				i.dest = low;
+			}
+		}
+
+		return e;
+	}
+
+	// The opcode byte of DD CB d op and FD CB d op.
+	constexpr DecodeEntry index_cb_entry(uint8_t b, bool iy) {
+		DecodeEntry e = cb_entry(b);
+		Instruction& i = e.instruction;
+
+		Opcode o = parse_opcode(b);
+
+		Regs index = iy ? Regs::IY : Regs::IX;
+
+		if (o.z != 6) {
+			i.name = get_alt_CB_name(i.name);
+			i.source = index;
+			i.dest = rTable[o.z];
+		}
+		else {
+			i.dest = index;
+		}
+
+		return e;
+	}
+
+	constexpr size_t prefix_length(Space space) {
+		switch (space) {
+		case Space::Main:
+			return 0;
+		case Space::DDCB:
+		case Space::FDCB:
+			return 3;
+		default:
+			break;
+		}
+
+		return 1;
+	}
+
+	constexpr std::array<DecodeEntry, 256> make_space(Space space) {
+		std::array<DecodeEntry, 256> table{};
+
+		for (size_t b = 0; b < 256; b++) {
+			DecodeEntry e;
+
+			switch (space) {
+			case Space::Main:
+				e = main_entry(b);
+				break;
+			case Space::CB:
+				e = cb_entry(b);
+				break;
+			case Space::ED:
+				e = ed_entry(b);
+				break;
+			case Space::DD:
+				e = index_entry(b, false);
+				break;
+			case Space::FD:
+				e = index_entry(b, true);
+				break;
+			case Space::DDCB:
+				e = index_cb_entry(b, false);
+				break;
+			case Space::FDCB:
+				e = index_cb_entry(b, true);
+				break;
+			}
+
+			if (!e.is_prefix) {
+				e.length = static_cast<uint8_t>(prefix_length(space) + 1 + (e.needs_displacement ? 1 : 0) + e.immediate_bytes);
+				e.timing = timing(e.instruction, e.length);
+			}
+
+			table[b] = e;
+		}
+
+		return table;
+	}
+
+	inline constexpr std::array<std::array<DecodeEntry, 256>, DecodeEntry::SpaceCount> table{
+		make_space(Space::Main),
+		make_space(Space::CB),
+		make_space(Space::ED),
+		make_space(Space::DD),
+		make_space(Space::FD),
+		make_space(Space::DDCB),
+		make_space(Space::FDCB)
+	};
+
+	constexpr const DecodeEntry& lookup(Space space, uint8_t b) {
+		return table[static_cast<size_t>(space)][b];
+	}
+
+}
@@ -4,6 +4,7 @@
 #include <functional>
 #include <array>
 #include <vector>
+#include <span>
 
 template <typename T>
 concept DeviceType =
@@ -12,6 +13,16 @@ concept DeviceType =
 		r.write(port_lo, port_hi, b);
 	};
 
+// Devices may also take a whole INIR/INDR/OTIR/OTDR run in one call. The
+// bytes are in transfer order, and port_hi is the high byte for the first
+// of them; it counts down by one for each byte after that, as B does.
+template <typename T>
+concept BlockDeviceType =
+	requires(T r, uint8_t port_lo, uint8_t port_hi, std::span<uint8_t> in, std::span<const uint8_t> out) {
+		r.read_block(port_lo, port_hi, in);
+		r.write_block(port_lo, port_hi, out);
+	};
+
 struct DeviceMap {
 
 	struct Mapping {
@@ -26,12 +37,26 @@ struct DeviceMap {
 				device.write(port_lo, port_hi, b);
 			};
 
+			if constexpr (BlockDeviceType<T>) {
+				read_block_fn = [&device](uint8_t port_lo, uint8_t port_hi, std::span<uint8_t> data) -> void {
+					device.read_block(port_lo, port_hi, data);
+				};
+
+				write_block_fn = [&device](uint8_t port_lo, uint8_t port_hi, std::span<const uint8_t> data) -> void {
+					device.write_block(port_lo, port_hi, data);
+				};
+			}
+
 			this->port = port;
 		}
 
 		std::function<uint8_t(uint8_t, uint8_t)> read_fn;
 		std::function<void(uint8_t, uint8_t, uint8_t)> write_fn;
 
+		// Empty unless the device takes blocks.
+		std::function<void(uint8_t, uint8_t, std::span<uint8_t>)> read_block_fn;
+		std::function<void(uint8_t, uint8_t, std::span<const uint8_t>)> write_block_fn;
+
 		uint8_t port;
 	};
 
@@ -76,6 +101,32 @@ struct DeviceMap {
 		}
 	}
 
+	bool takes_blocks(uint8_t port_lo) const {
+		for (auto& mapping : mappings) {
+			if (port_lo == mapping.port) {
+				return static_cast<bool>(mapping.read_block_fn);
+			}
+		}
+
+		return false;
+	}
+
+	void read_block(uint8_t port_lo, uint8_t port_hi, std::span<uint8_t> data) {
+		for (auto& mapping : mappings) {
+			if (port_lo == mapping.port) {
+				mapping.read_block_fn(port_lo, port_hi, data);
+			}
+		}
+	}
+
+	void write_block(uint8_t port_lo, uint8_t port_hi, std::span<const uint8_t> data) {
+		for (auto& mapping : mappings) {
+			if (port_lo == mapping.port) {
+				mapping.write_block_fn(port_lo, port_hi, data);
+			}
+		}
+	}
+
 	std::vector<Mapping> mappings;
 
 };
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <cstddef>
+
+class Fiber;
+
+extern "C" void soft80_fiber_main(Fiber* fiber);
+
+// A body that runs on its own stack, taking turns with whoever resumes it
+// on the same host thread. Code on the fiber can give the thread back from
+// any depth of calls, so the executor's waits need no restructuring.
+class Fiber {
+
+public:
+
+	// Thrown out of suspend() when a fiber is destroyed while suspended, so
+	// that the body's frames unwind before the stack is freed. Code that
+	// catches it must let it go on.
+	struct Unwind {};
+
+	explicit Fiber(std::function<void()> body, size_t stack_size = 256 * 1024);
+	~Fiber();
+
+	Fiber(const Fiber&) = delete;
+	Fiber& operator=(const Fiber&) = delete;
+
+	// Runs the body until it suspends or returns. Does nothing once it has
+	// returned.
+	void resume();
+
+	// From the body: hands the thread back to resume()'s caller.
+	void suspend();
+
+	// Unwinds a suspended body now, as destroying the fiber does, for
+	// owners whose state the body's frames still refer to. The fiber is
+	// finished afterwards.
+	void unwind();
+
+	bool finished() const;
+	bool unwinding() const;
+
+private:
+
+	struct Context;
+
+	std::function<void()> body;
+	std::unique_ptr<std::byte[]> stack;
+	size_t stack_size;
+
+	std::unique_ptr<Context> context;
+
+	bool started{ false };
+	bool done{ false };
+	bool unwind_requested{ false };
+
+	friend void ::soft80_fiber_main(Fiber* fiber);
+
+};
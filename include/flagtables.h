@@ -0,0 +1,125 @@
+#pragma once
+
+#include "registers.h"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Flags of the 8-bit ALU operations, built at compile time. Each table
+// reproduces what the interpreter derives from its 32-bit results, so
+// looking an entry up is interchangeable with computing it.
+namespace FlagTables {
+
+	// Sign, zero, F5, F3 and parity, indexed by a result of up to nine bits.
+	// Zero is only set for a result of 0, never for 0x100.
+	constexpr std::array<uint8_t, 512> make_szp() {
+		std::array<uint8_t, 512> table{};
+
+		for (uint32_t i = 0; i < 512; i++) {
+			uint8_t flags = i & (FlagBits::Sign | FlagBits::F5 | FlagBits::F3);
+
+			if (i == 0) {
+				flags |= FlagBits::Zero;
+			}
+
+			if (std::popcount(i & 0xFF) % 2 == 0) {
+				flags |= FlagBits::Overflow;
+			}
+
+			table[i] = flags;
+		}
+
+		return table;
+	}
+
+	// Sign, zero, F5, F3, overflow and carry of an add or subtract, indexed
+	// by the low nine bits of the result. Any result in [-256, 511] maps to
+	// the right entry, which covers every pair of 8-bit operands and carry.
+	constexpr std::array<uint8_t, 512> make_arithmetic() {
+		std::array<uint8_t, 512> table{};
+
+		for (uint32_t i = 0; i < 512; i++) {
+			uint8_t flags = i & (FlagBits::Sign | FlagBits::F5 | FlagBits::F3);
+
+			if (i == 0) {
+				flags |= FlagBits::Zero;
+			}
+
+			if (i & 0x100) {
+				flags |= FlagBits::Overflow | FlagBits::Carry;
+			}
+
+			table[i] = flags;
+		}
+
+		return table;
+	}
+
+	inline constexpr std::array<uint8_t, 512> szp = make_szp();
+	inline constexpr std::array<uint8_t, 512> arithmetic = make_arithmetic();
+
+	// INC r and DEC r, indexed by the operand. Carry is left alone by both.
+	constexpr std::array<uint8_t, 256> make_inc_dec(bool subtract) {
+		std::array<uint8_t, 256> table{};
+
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t result = subtract ? i - 1 : i + 1;
+
+			table[i] = arithmetic[result & 0x1FF] & ~FlagBits::Carry;
+
+			if (subtract) {
+				table[i] |= FlagBits::Subtract;
+			}
+		}
+
+		return table;
+	}
+
+	inline constexpr std::array<uint8_t, 256> inc = make_inc_dec(false);
+	inline constexpr std::array<uint8_t, 256> dec = make_inc_dec(true);
+
+	struct Adjustment {
+		uint16_t result;
+		uint8_t flags;
+	};
+
+	// DAA, indexed by A | H << 8 | C << 9. Half carry still depends on the
+	// operands and is added by the caller.
+	constexpr std::array<Adjustment, 1024> make_daa() {
+		std::array<Adjustment, 1024> table{};
+
+		for (uint32_t i = 0; i < 1024; i++) {
+			uint32_t A = i & 0xFF;
+			bool half_carry = i & 0x100;
+			bool carry = i & 0x200;
+
+			uint32_t result = A;
+
+			if ((A & 0x0F) > 0x09 || half_carry) {
+				result += 0x06;
+			}
+
+			if ((A >> 4) > 0x09 || carry) {
+				result += 0x60;
+			}
+
+			uint8_t flags = szp[result];
+
+			if (result & 0x100) {
+				flags |= FlagBits::Carry;
+			}
+
+			table[i] = { static_cast<uint16_t>(result), flags };
+		}
+
+		return table;
+	}
+
+	inline constexpr std::array<Adjustment, 1024> daa = make_daa();
+
+	inline constexpr size_t daa_index(uint8_t A, bool half_carry, bool carry) {
+		return A | (half_carry ? 0x100 : 0) | (carry ? 0x200 : 0);
+	}
+
+}
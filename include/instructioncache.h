@@ -0,0 +1,105 @@
+#pragma once
+
+#include "decoder.h"
+
+#include <array>
+#include <memory>
+#include <cstdint>
+
+struct CachedInstruction {
+	Instruction instruction;
+	uint8_t length{ 0 };
+	uint8_t handler{ 0 };
+	DecodeEntry::Timing timing;
+	std::array<uint8_t, 4> bytes{};
+
+	// In a block, one more than the superinstruction that runs this entry
+	// together with the next; zero if it runs alone.
+	uint8_t fused{ 0 };
+};
+
+class InstructionCache {
+
+public:
+
+	const CachedInstruction* lookup(uint16_t address) {
+		auto& page = pages[address / PageSize];
+
+		if (!page) {
+			return nullptr;
+		}
+
+		CachedInstruction& entry = (*page)[address % PageSize];
+
+		if (entry.length == 0) {
+			return nullptr;
+		}
+
+		return &entry;
+	}
+
+	void insert(uint16_t address, const CachedInstruction& entry) {
+		auto& page = pages[address / PageSize];
+
+		if (!page) {
+			page = std::make_unique<Page>();
+		}
+
+		(*page)[address % PageSize] = entry;
+
+		code_pages[address / PageSize] = true;
+		code_pages[static_cast<uint16_t>(address + entry.length - 1) / PageSize] = true;
+	}
+
+	// Set once any instruction with a byte in the page has been cached, and
+	// only cleared by clear(). Writes to unflagged pages cannot hit the cache.
+	const bool* code_page_flag(uint16_t address) const {
+		return &code_pages[address / PageSize];
+	}
+
+	// Drops every entry with at least one byte in [low, high]. An entry can
+	// start up to MaxLength - 1 bytes before the first written address.
+	void invalidate(uint16_t low, uint16_t high) {
+		size_t count = static_cast<uint16_t>(high - low) + MaxLength;
+
+		for (size_t i = 0; i < count; i++) {
+			uint16_t address = static_cast<uint16_t>(low - (MaxLength - 1) + i);
+
+			auto& page = pages[address / PageSize];
+
+			if (!page) {
+				i += PageSize - 1 - (address % PageSize);
+				continue;
+			}
+
+			CachedInstruction& entry = (*page)[address % PageSize];
+
+			bool overlaps = static_cast<uint16_t>(low - address) < entry.length
+				|| static_cast<uint16_t>(address - low) <= static_cast<uint16_t>(high - low);
+
+			if (entry.length > 0 && overlaps) {
+				entry.length = 0;
+			}
+		}
+	}
+
+	void clear() {
+		for (auto& page : pages) {
+			page.reset();
+		}
+
+		code_pages.fill(false);
+	}
+
+private:
+
+	static const size_t PageSize = 256;
+	static const size_t MaxLength = 4;
+	static const size_t PageCount = 0x10000 / PageSize;
+
+	using Page = std::array<CachedInstruction, PageSize>;
+
+	std::array<std::unique_ptr<Page>, PageCount> pages;
+	std::array<bool, PageCount> code_pages{};
+
+};
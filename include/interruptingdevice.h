@@ -6,30 +6,82 @@ class InterruptingDevice {
 
 public:
 
-	InterruptingDevice() {
-		execution_thread = std::thread(&InterruptingDevice::executor_impl, this);
+	// Threaded runs the executor on its own thread. Cooperative runs it on
+	// a fiber that cycle_clock() resumes, as Soft80 does.
+	InterruptingDevice(Soft80::ExecutionMode mode = Soft80::ExecutionMode::Threaded) : mode(mode) {
+		if (mode == Soft80::ExecutionMode::Cooperative) {
+			fiber = std::make_unique<Fiber>([this] { executor_impl(); });
+		}
 	}
 
 	~InterruptingDevice() {
 		should_executor_exit = true;
-		execution_thread.join();
+
+		clock_credit.fetch_add(1, std::memory_order_release);
+		clock_credit.notify_all();
+
+		if (execution_thread.joinable()) {
+			execution_thread.join();
+		}
+
+		// The derived device is already gone, so its executor() must not
+		// keep anything on the stack that refers to it across a wait.
+		if (fiber) {
+			fiber->unwind();
+		}
 	}
 
 	virtual uint8_t read(uint8_t port_lo, uint8_t port_hi) = 0;
 
 	virtual void write(uint8_t port_lo, uint8_t port_hi, uint8_t b) = 0;
 
+	// The thread is started here rather than in the constructor, which runs
+	// before the derived device's executor() exists.
 	void connect(Soft80& zcpu) {
 		this->zcpu = &zcpu;
+
+		if (mode != Soft80::ExecutionMode::Cooperative && !execution_thread.joinable()) {
+			execution_thread = std::thread(&InterruptingDevice::executor_impl, this);
+		}
 	}
 
-	void cycle_clock() {
-		should_cycle = true;
+	// Grants t_cycles more clocks and returns how many the executor has
+	// used since the last call, as Soft80::cycle_clock() does.
+	size_t cycle_clock(size_t t_cycles = 1) {
+		clock_granted += t_cycles;
+		clock_credit.fetch_add(t_cycles, std::memory_order_release);
+
+		if (clock_wait == Soft80::ClockWait::Block) {
+			clock_credit.notify_one();
+		}
+
+		if (fiber && !should_executor_exit) {
+			fiber->resume();
+		}
+
+		size_t used = clock_granted - std::min(clock_granted, clock_credit.load(std::memory_order_acquire));
+
+		if (used <= clock_reported) {
+			return 0;
+		}
+
+		return used - std::exchange(clock_reported, used);
+	}
+
+	// Blocking also makes the executor and the waits on the CPU poll once
+	// per clock instead of continuously.
+	void set_clock_wait(Soft80::ClockWait wait) {
+		clock_wait = wait;
 	}
 
 protected:
 
-	std::atomic<bool> should_cycle{ false };
+	std::atomic<size_t> clock_credit{ 0 };
+	Soft80::ClockWait clock_wait{ Soft80::ClockWait::Yield };
+
+	size_t clock_granted{ 0 };
+	size_t clock_reported{ 0 };
+
 	std::atomic<bool> should_executor_exit{ false };
 
 	virtual void executor() = 0;
@@ -38,43 +90,70 @@ protected:
 		while (!should_executor_exit) {
 			executor();
 
-			std::this_thread::yield();
+			if (fiber) {
+				fiber->suspend();
+			}
+			else {
+				poll_pause();
+			}
 		}
 	}
 
 	void wait_next_clock() {
-		while (!should_cycle) {
-			if (should_executor_exit) {
-				exit(0);
-			}
-
-			std::this_thread::yield();
+		while (clock_credit.load(std::memory_order_acquire) == 0) {
+			wait_for_clock();
 		}
 
-		should_cycle = false;
+		clock_credit.fetch_sub(1, std::memory_order_acq_rel);
 	}
 
 	void wait_cpu_int_ack() {
-		while (!(zcpu->read_iorq() && zcpu->read_m1())) {
-			if (should_executor_exit) {
-				exit(0);
-			}
+		const uint32_t acknowledge = PinBits::IORQ | PinBits::M1;
 
-			std::this_thread::yield();
+		while ((zcpu->read_pins() & acknowledge) != acknowledge) {
+			poll_pause();
 		}
 	}
 
 	void wait_cpu_halt() {
 		while (!zcpu->read_halt()) {
-			if (should_executor_exit) {
-				exit(0);
-			}
+			poll_pause();
+		}
+	}
 
+	// Between two looks at something the CPU or the host changes.
+	void poll_pause() {
+		if (clock_wait == Soft80::ClockWait::Block && !fiber) {
+			wait_next_clock();
+		}
+		else {
+			wait_for_clock();
+		}
+	}
+
+	void wait_for_clock() {
+		if (fiber) {
+			fiber->suspend();
+
+			return;
+		}
+
+		if (should_executor_exit) {
+			exit(0);
+		}
+
+		if (clock_wait == Soft80::ClockWait::Block) {
+			clock_credit.wait(0, std::memory_order_acquire);
+		}
+		else {
 			std::this_thread::yield();
 		}
 	}
 
+	Soft80::ExecutionMode mode;
+
 	std::thread execution_thread;
+	std::unique_ptr<Fiber> fiber;
 
 	Soft80* zcpu{ nullptr };
 
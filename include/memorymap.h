@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <array>
 #include <vector>
+#include <algorithm>
 
 template <typename T>
 concept MemoryRegionType =
@@ -29,6 +31,8 @@ struct MemoryBlock {
 		}
 	}
 
+	static constexpr bool is_mutable = Mutable;
+
 	std::array<uint8_t, Size> data;
 
 };
@@ -55,6 +59,24 @@ struct MemoryMap {
 
 			low_bound = low;
 			high_bound = high;
+
+			if constexpr (requires { T::is_mutable; }) {
+				is_mutable = T::is_mutable;
+			}
+
+			if constexpr (requires { { region.data.data() } -> std::same_as<uint8_t*>; }) {
+				direct = region.data.data();
+				direct_size = region.data.size();
+			}
+		}
+
+		// Host storage backing the region, for plain memory blocks only.
+		uint8_t* direct_pointer(uint16_t addr) const {
+			if (!direct || static_cast<size_t>(addr - low_bound) >= direct_size) {
+				return nullptr;
+			}
+
+			return direct + (addr - low_bound);
 		}
 
 		std::function<uint8_t(uint16_t)> read_fn;
@@ -62,6 +84,11 @@ struct MemoryMap {
 
 		uint16_t low_bound;
 		uint16_t high_bound;
+
+		bool is_mutable{ true };
+
+		uint8_t* direct{ nullptr };
+		size_t direct_size{ 0 };
 	};
 
 	enum class Error {
@@ -80,6 +107,8 @@ struct MemoryMap {
 
 		mappings.push_back(m);
 
+		notify_write(m.low_bound, m.high_bound);
+
 		return Error::OK;
 	}
 
@@ -102,10 +131,75 @@ struct MemoryMap {
 		for (auto& mapping : mappings) {
 			if (addr >= mapping.low_bound && addr <= mapping.high_bound) {
 				mapping.write_fn(addr, b);
+
+				if (mapping.is_mutable) {
+					notify_write(addr, addr);
+				}
+			}
+		}
+	}
+
+	const Mapping* find_mapping(uint16_t addr) const {
+		for (auto& mapping : mappings) {
+			if (addr >= mapping.low_bound && addr <= mapping.high_bound) {
+				return &mapping;
+			}
+		}
+
+		return nullptr;
+	}
+
+	// Host storage for a run of up to length bytes starting at addr and
+	// stepping by delta, all in one plain memory block with nothing else
+	// mapped over them. Shortens length to the part that qualifies and
+	// returns the byte at addr, or null if not even that one does.
+	uint8_t* direct_run(uint16_t addr, int delta, size_t& length, bool write) const {
+		const Mapping* mapping = find_mapping(addr);
+
+		if (!mapping || !mapping->direct_pointer(addr) || (write && !mapping->is_mutable)) {
+			return nullptr;
+		}
+
+		size_t low = mapping->low_bound;
+		size_t high = std::min<size_t>(mapping->high_bound, low + mapping->direct_size - 1);
+
+		length = std::min(length, delta > 0 ? high - addr + 1 : addr - low + 1);
+
+		size_t first = delta > 0 ? addr : addr - (length - 1);
+		size_t last = first + length - 1;
+
+		for (auto& other : mappings) {
+			if (&other != mapping && other.low_bound <= last && other.high_bound >= first) {
+				return nullptr;
+			}
+		}
+
+		return mapping->direct_pointer(addr);
+	}
+
+	size_t mapping_count(uint16_t addr) const {
+		size_t count = 0;
+
+		for (auto& mapping : mappings) {
+			if (addr >= mapping.low_bound && addr <= mapping.high_bound) {
+				count++;
 			}
 		}
+
+		return count;
+	}
+
+	void add_write_watcher(std::function<void(uint16_t, uint16_t)> fn) {
+		write_watchers.push_back(fn);
+	}
+
+	void notify_write(uint16_t low, uint16_t high) {
+		for (auto& watcher : write_watchers) {
+			watcher(low, high);
+		}
 	}
 
 	std::vector<Mapping> mappings;
+	std::vector<std::function<void(uint16_t, uint16_t)>> write_watchers;
 
 };
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "blockcache.h"
+
+#include <optional>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class Soft80;
+
+// Translates basic blocks into x86-64 code. AF, BC, DE, HL and SP stay in
+// host registers for the length of a block; instructions without a native
+// lowering are handed back to the interpreter with the registers spilled.
+class Recompiler {
+
+public:
+
+	Recompiler(Soft80& cpu);
+	~Recompiler();
+
+	Recompiler(const Recompiler&) = delete;
+	Recompiler& operator=(const Recompiler&) = delete;
+
+	static bool is_supported();
+
+	// Returns nullptr when the block does not fit in what is left of the
+	// code buffer.
+	BasicBlock::NativeCode compile(const BasicBlock& block);
+
+	// Recycles the code buffer. Every previously returned pointer dangles.
+	void reset();
+
+private:
+
+	class Assembler;
+
+	struct Slot {
+		uint8_t reg;
+		bool high;
+	};
+
+	struct BlockState {
+		uint32_t pending_t_cycles{ 0 };
+		bool pc_in_eax{ false };
+		std::vector<size_t> exits;
+	};
+
+	static const size_t BufferSize = 4 * 1024 * 1024;
+
+	Soft80& cpu;
+
+	uint8_t* buffer{ nullptr };
+	size_t buffer_used{ 0 };
+
+	bool emit_native(Assembler& a, BlockState& state, const BasicBlock& block, const CachedInstruction& entry, uint16_t next);
+	void emit_interpreter_call(Assembler& a, BlockState& state, const BasicBlock& block, const CachedInstruction& entry, uint16_t address, bool last);
+
+	void emit_flush_t_cycles(Assembler& a, BlockState& state);
+	void emit_store_pc(Assembler& a, uint16_t pc);
+	void emit_spill(Assembler& a);
+	void emit_reload(Assembler& a);
+	void emit_load8(Assembler& a, Slot slot);
+	void emit_store8(Assembler& a, Slot slot);
+	void emit_clear_flags(Assembler& a);
+
+	static std::optional<Slot> slot8(RegisterFile::Names name);
+	static std::optional<uint8_t> reg16(RegisterFile::Names name);
+
+	static bool call_interpreter(Soft80* cpu, const CachedInstruction* entry, const BasicBlock* block);
+	static bool call_notify_write(Soft80* cpu, uint32_t address, const BasicBlock* block);
+
+};
@@ -2,6 +2,11 @@
 
 #include <optional>
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include <type_traits>
 
 enum class FlagNames {
 	None			= 0,
@@ -194,6 +199,164 @@ struct RegisterFile {
 	std::optional<uint16_t> get_value(Names name);
 	void set_value(Names name, uint16_t value);
 
-	static bool is_16bit(Names name);
+	// Access by name when the width is already known, as it is from an
+	// operand's kind; no range check.
+	template <bool Wide>
+	uint16_t read(Names name) const;
+
+	template <bool Wide>
+	void write(Names name, uint16_t value);
+
+	// EXX: BC, DE and HL sit together in each bank.
+	void exchange_banks();
+
+	static constexpr bool is_16bit(Names name) {
+
+		switch (name) {
+		case Names::A:
+		case Names::B:
+		case Names::C:
+		case Names::D:
+		case Names::E:
+		case Names::F:
+		case Names::H:
+		case Names::L:
+		case Names::Aalt:
+		case Names::Balt:
+		case Names::Calt:
+		case Names::Dalt:
+		case Names::Ealt:
+		case Names::Falt:
+		case Names::Halt:
+		case Names::Lalt:
+		case Names::IXH:
+		case Names::IXL:
+		case Names::IYH:
+		case Names::IYL:
+		case Names::I:
+		case Names::R:
+		case Names::Immediate:
+		case Names::None:
+			return false;
+			break;
+
+		case Names::AF:
+		case Names::BC:
+		case Names::DE:
+		case Names::HL:
+		case Names::SP:
+		case Names::AFalt:
+		case Names::BCalt:
+		case Names::DEalt:
+		case Names::HLalt:
+		case Names::IX:
+		case Names::IY:
+			return true;
+		}
+
+		return false;
+	}
 
 };
+
+// The register file is one run of bytes: the main and alternate banks, then
+// IX, IY, SP, I, R and PC. Each name resolves to an offset into it, so the
+// whole file copies with a memcpy.
+static_assert(std::is_trivially_copyable_v<RegisterFile>);
+static_assert(std::is_standard_layout_v<RegisterFile>);
+
+struct RegisterSlot {
+	uint8_t offset{ 0 };
+	bool wide{ false };
+	bool valid{ false };
+};
+
+constexpr std::array<RegisterSlot, static_cast<size_t>(RegisterFile::Names::None) + 1> make_register_slots() {
+	using Names = RegisterFile::Names;
+
+	std::array<RegisterSlot, static_cast<size_t>(Names::None) + 1> ret{};
+
+	auto set = [&ret](Names name, size_t offset) {
+		ret[static_cast<size_t>(name)] = { static_cast<uint8_t>(offset), RegisterFile::is_16bit(name), true };
+	};
+
+	constexpr size_t main = offsetof(RegisterFile, main);
+	constexpr size_t alt = offsetof(RegisterFile, alt);
+
+	set(Names::A, main + offsetof(GeneralRegisters, A));
+	set(Names::B, main + offsetof(GeneralRegisters, B));
+	set(Names::C, main + offsetof(GeneralRegisters, C));
+	set(Names::D, main + offsetof(GeneralRegisters, D));
+	set(Names::E, main + offsetof(GeneralRegisters, E));
+	set(Names::F, main + offsetof(GeneralRegisters, F));
+	set(Names::H, main + offsetof(GeneralRegisters, H));
+	set(Names::L, main + offsetof(GeneralRegisters, L));
+	set(Names::AF, main + offsetof(GeneralRegisters, AF));
+	set(Names::BC, main + offsetof(GeneralRegisters, BC));
+	set(Names::DE, main + offsetof(GeneralRegisters, DE));
+	set(Names::HL, main + offsetof(GeneralRegisters, HL));
+	set(Names::SP, offsetof(RegisterFile, SP));
+	set(Names::Aalt, alt + offsetof(GeneralRegisters, A));
+	set(Names::Balt, alt + offsetof(GeneralRegisters, B));
+	set(Names::Calt, alt + offsetof(GeneralRegisters, C));
+	set(Names::Dalt, alt + offsetof(GeneralRegisters, D));
+	set(Names::Ealt, alt + offsetof(GeneralRegisters, E));
+	set(Names::Falt, alt + offsetof(GeneralRegisters, F));
+	set(Names::Halt, alt + offsetof(GeneralRegisters, H));
+	set(Names::Lalt, alt + offsetof(GeneralRegisters, L));
+	set(Names::AFalt, alt + offsetof(GeneralRegisters, AF));
+	set(Names::BCalt, alt + offsetof(GeneralRegisters, BC));
+	set(Names::DEalt, alt + offsetof(GeneralRegisters, DE));
+	set(Names::HLalt, alt + offsetof(GeneralRegisters, HL));
+	set(Names::IXH, offsetof(RegisterFile, IXH));
+	set(Names::IXL, offsetof(RegisterFile, IXL));
+	set(Names::IX, offsetof(RegisterFile, IX));
+	set(Names::IYH, offsetof(RegisterFile, IYH));
+	set(Names::IYL, offsetof(RegisterFile, IYL));
+	set(Names::IY, offsetof(RegisterFile, IY));
+	set(Names::I, offsetof(RegisterFile, I));
+	set(Names::R, offsetof(RegisterFile, R));
+
+	return ret;
+}
+
+inline constexpr auto register_slots = make_register_slots();
+
+template <bool Wide>
+inline uint16_t RegisterFile::read(Names name) const {
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(this) + register_slots[static_cast<size_t>(name)].offset;
+
+	if constexpr (Wide) {
+		uint16_t value;
+		memcpy(&value, bytes, sizeof(value));
+
+		return value;
+	}
+	else {
+		return *bytes;
+	}
+}
+
+template <bool Wide>
+inline void RegisterFile::write(Names name, uint16_t value) {
+	uint8_t* bytes = reinterpret_cast<uint8_t*>(this) + register_slots[static_cast<size_t>(name)].offset;
+
+	if constexpr (Wide) {
+		memcpy(bytes, &value, sizeof(value));
+	}
+	else {
+		*bytes = static_cast<uint8_t>(value);
+	}
+}
+
+inline void RegisterFile::exchange_banks() {
+	constexpr size_t first = register_slots[static_cast<size_t>(Names::BC)].offset;
+	constexpr size_t last = register_slots[static_cast<size_t>(Names::HL)].offset + 2;
+	constexpr size_t other = register_slots[static_cast<size_t>(Names::BCalt)].offset;
+
+	static_assert(register_slots[static_cast<size_t>(Names::HLalt)].offset + 2 - other == last - first);
+
+	uint8_t* bytes = reinterpret_cast<uint8_t*>(this);
+
+	std::swap_ranges(bytes + first, bytes + last, bytes + other);
+}
@@ -2,24 +2,137 @@
 
 #include "registers.h"
 #include "decoder.h"
+#include "instructioncache.h"
+#include "blockcache.h"
+#include "recompiler.h"
 #include "memorymap.h"
 #include "devicemap.h"
+#include "fiber.h"
 
 #include <optional>
+#include <array>
+#include <utility>
 #include <functional>
 #include <vector>
-#include <stack>
+#include <unordered_map>
 #include <thread>
 #include <atomic>
+#include <bitset>
+#include <ostream>
 #include <cstdint>
 
+// Asynchronous inputs, as bits of the pending-event word.
+namespace EventBits {
+	static const uint32_t NMI		= 0b0000'0001;
+	static const uint32_t INT		= 0b0000'0010;
+	static const uint32_t BUSREQ	= 0b0000'0100;
+	static const uint32_t RESET		= 0b0000'1000;
+	static const uint32_t WAIT		= 0b0001'0000;
+	static const uint32_t VECTOR	= 0b0010'0000;
+};
+
+// Output pins, as bits of the word devices read.
+namespace PinBits {
+	static const uint32_t BUSACK	= 0b0000'0001;
+	static const uint32_t HALT		= 0b0000'0010;
+	static const uint32_t IORQ		= 0b0000'0100;
+	static const uint32_t M1		= 0b0000'1000;
+	static const uint32_t MREQ		= 0b0001'0000;
+	static const uint32_t RD		= 0b0010'0000;
+	static const uint32_t WR		= 0b0100'0000;
+	static const uint32_t RFSH		= 0b1000'0000;
+
+	// The pins every machine cycle drives.
+	static const uint32_t Bus		= IORQ | M1 | MREQ | RD | WR | RFSH;
+};
+
 class Soft80 {
 
+	// State written by different threads is kept on separate lines, so that
+	// one thread's stores do not keep taking the line from another.
+	static const size_t CacheLineSize = 64;
+
 public:
 
-	Soft80();
+	// Cooperative runs the executor on a fiber in the thread that calls
+	// cycle_clock(), until it has used the clock granted. Any number of CPUs
+	// and devices can then share one host thread.
+	enum class ExecutionMode {
+		Threaded,
+		Synchronous,
+		Cooperative
+	};
+
+	// How a threaded executor waits for cycle_clock(). Yield spins and
+	// reacts fastest. Block sleeps until the clock grants more T-states, so
+	// a stopped clock costs no host time.
+	enum class ClockWait {
+		Yield,
+		Block
+	};
+
+	enum class ExecutionTier {
+		Interpreter,
+		BasicBlocks,
+		Recompiler
+	};
+
+	// Bus-cycle accuracy steps every T-state and drives the pins.
+	// Instruction-cycle accuracy runs each instruction at once and then
+	// advances the clock by its cost from the decode table; pins are left
+	// alone and WAIT and BUSREQ are not sampled.
+	// Functional accuracy models no timing. The T-state count only measures
+	// work, at each instruction's base cost, so that run_for() has a budget.
+	// A threaded executor runs as fast as it can; a cooperative one does a
+	// grant's worth of base costs each time it is clocked.
+	enum class Accuracy {
+		BusCycle,
+		InstructionCycle,
+		Functional
+	};
+
+	// Waiting and BusRequest stop a run in the middle of an instruction,
+	// with WAIT or BUSREQ still held; the next call carries on from there.
+	enum class StopReason {
+		None,
+		BudgetExhausted,
+		Halted,
+		Breakpoint,
+		Waiting,
+		BusRequest
+	};
+
+	struct RunResult {
+		size_t t_cycles;
+		StopReason reason;
+	};
+
+	// How often one operation directly followed another.
+	struct PairCount {
+		Instruction::Names first;
+		OperandKind first_dest;
+		OperandKind first_source;
+		Instruction::Names second;
+		OperandKind second_dest;
+		OperandKind second_source;
+		size_t count;
+	};
+
+	// One instruction as it was fetched. An IM 0 response comes off the data
+	// bus, so it has no bytes.
+	struct HistoryEntry {
+		size_t t_cycles;
+		uint16_t pc;
+		uint8_t length;
+		std::array<uint8_t, 4> bytes;
+	};
+
+	Soft80(ExecutionMode mode = ExecutionMode::Threaded);
 	~Soft80();
 
+	// All the pins at one instant, as PinBits.
+	uint32_t read_pins();
+
 	bool read_busack();
 	bool read_halt();
 	bool read_iorq();
@@ -29,32 +142,158 @@ public:
 	bool read_wr();
 	bool read_rfsh();
 
-	void add_busreq_source(bool& b);
-	void add_reset_source(bool& b);
-	void add_wait_source(bool& b);
+	// Drive the input lines. Devices sharing a line combine their requests
+	// before setting it. Safe to call from any thread.
+	void set_busreq(bool asserted);
+	void set_reset(bool asserted);
+	void set_wait(bool asserted);
 
 	void signal_int();
 	void signal_nmi();
 
-	void cycle_clock();
+	// Answers an interrupt acknowledge with vector on the data bus. In IM 0
+	// and IM 2 a threaded or cooperative CPU holds IORQ and M1 until a
+	// device has called this, however much clock it has been granted.
+	void place_vector(uint8_t vector);
+
+	// Grants t_cycles more T-states of clock, which the executor runs into
+	// without waiting for further calls. Returns the T-states it has used
+	// since the last call. A cooperative executor uses the whole grant
+	// before this returns; a threaded one may still be working through it.
+	size_t cycle_clock(size_t t_cycles = 1);
+	void set_clock_wait(ClockWait wait);
+
+	// step() and run_for() only work on a synchronous CPU; on any other
+	// they do nothing and return StopReason::None.
+	RunResult step();
+
+	// A halted CPU with no interrupt to take spends the rest of the budget
+	// halted; the halt cycles are counted rather than run one by one.
+	RunResult run_for(size_t t_cycles);
+
+	void add_breakpoint(uint16_t address);
+	void remove_breakpoint(uint16_t address);
+
+	void set_execution_tier(ExecutionTier tier);
+	void set_accuracy(Accuracy level);
+
+	// Counts adjacent pairs of executed instructions. The histogram is most
+	// frequent first.
+	void set_pair_profiling(bool enabled);
+	std::vector<PairCount> pair_histogram() const;
+
+	// Keeps the last depth instructions fetched, for post-mortem dumps. The
+	// ring is allocated here and never grows; zero stops recording. Read it
+	// only while the executor is stopped.
+	void set_history_depth(size_t depth);
+	std::vector<HistoryEntry> history() const;
+	void dump_history(std::ostream& out) const;
+
+	void add_static_blocks(const StaticBlock* blocks, size_t count);
 
 	void kill();
 
 	MemoryMap memory;
 	DeviceMap devices;
 
-	uint8_t data_bus;
+	// The bus as devices see it, on a cache line with the pins.
+	alignas(CacheLineSize) uint8_t data_bus;
 	uint16_t address_bus;
 
 private:
 
-	std::atomic<bool> should_cycle{ false };
+	friend class Recompiler;
+	friend class StaticCode;
+
+	// Only the executor writes the pins; devices read them from their own
+	// threads.
+	std::atomic<uint32_t> pins{ 0 };
+
+	void set_pins(uint32_t bits, bool asserted);
+	void set_bus_pins(uint32_t levels);
+
+	// Written by other threads: the clock, the inputs and kill(). First the
+	// T-states granted by cycle_clock() that the executor has not used yet.
+	alignas(CacheLineSize) std::atomic<size_t> clock_credit{ 0 };
+	ClockWait clock_wait{ ClockWait::Yield };
+
+	// Latched NMI and INT requests and the levels of the other inputs. It
+	// is almost always zero, so one load tells the executor there is
+	// nothing to do.
+	std::atomic<uint32_t> pending_events{ 0 };
+
+	// Bumped by anything that can end a halt, so the executor thread can
+	// sleep on it instead of running halt cycles.
+	std::atomic<uint32_t> wakeups{ 0 };
+
 	std::atomic<bool> should_executor_exit{ false };
 
+	// Kept by the thread that calls cycle_clock(). What has been granted and
+	// is no longer in the credit has been used.
+	size_t clock_granted{ 0 };
+	size_t clock_reported{ 0 };
+
+	// From here on, state only the executor touches.
+	alignas(CacheLineSize) ExecutionMode execution_mode;
+
 	void executor();
+	bool executor_pass();
 	void wait_next_clock();
+	size_t take_clock(size_t t_cycles);
+	void wait_for_clock();
+
+	void wake();
+	void wait_for_vector();
+	bool interrupt_pending();
+	void sleep_while_halted();
+	void fast_forward_halt(size_t deadline);
+
+	StopReason stop_reason();
+
+	std::unique_ptr<Fiber> sync_fiber;
+	bool single_step{ false };
+	StopReason sync_stop{ StopReason::None };
+
+	void synchronous_executor();
+	void run_synchronous();
+	void stall(StopReason reason);
+
+	ExecutionTier execution_tier{ ExecutionTier::Interpreter };
+	Accuracy accuracy{ Accuracy::BusCycle };
+
+	BlockCache block_cache;
+	Decoder block_decoder;
+	Recompiler recompiler{ *this };
+
+	std::unordered_map<uint16_t, StaticBlock> static_blocks;
+	BasicBlock* active_block{ nullptr };
+
+	// Repeating block instructions may run several iterations at once, but
+	// none that would start at or after this T-state.
+	size_t bulk_deadline{ 0 };
+
+	size_t bulk_iterations(size_t remaining, uint8_t opcode);
+	bool overwrites_instruction(uint16_t low, uint16_t high);
+
+	bool skip_idle_loop(size_t deadline);
+	void charge_bulk_iterations(size_t count, bool finished);
+
+	bool can_enter_block();
+	bool run_blocks(size_t deadline);
+	void execute_block(BasicBlock* block);
+	void execute_cached(const CachedInstruction& entry);
+	bool can_run_native();
+	void compile_block(BasicBlock* block);
+	BasicBlock::NativeCode find_static_code(const BasicBlock* block);
+	BasicBlock* find_block(uint16_t address);
+	BasicBlock* build_block(uint16_t address);
+	bool service_interrupts();
+
+	std::bitset<0x10000> breakpoints;
 
 	void fetch_opcode();
+	uint8_t fetch_cycle(bool read);
+	uint8_t fetch_untimed(bool read);
 	uint8_t read_memory(uint16_t address);
 	void write_memory(uint16_t address, uint8_t value);
 	uint8_t read_io(uint8_t port_lo, uint8_t port_hi);
@@ -62,21 +301,403 @@ private:
 	void bus_acknowledge();
 	void int_acknowledge();
 	void nmi_acknowledge();
+	void charge_untimed_accesses(size_t count);
 
 	std::thread execution_thread;
+	std::unique_ptr<Fiber> fiber;
+
+	// Oldest entry at history_next once the ring has filled.
+	std::vector<HistoryEntry> history_ring;
+	size_t history_next{ 0 };
+	bool history_full{ false };
+
+	void record_history(uint16_t pc, uint8_t length, const std::array<uint8_t, 4>& bytes, size_t t_cycles);
+
+	// Every decoded instruction is bound once to an index into the handler
+	// table. Handlers are instantiated per operation and operand kinds, for
+	// each combination the decoder can produce, so operand access is
+	// resolved at compile time.
+	using Handler = void (Soft80::*)(const Instruction& instruction);
+
+	struct Operands {
+		uint16_t dest_value{ 0 };
+		uint16_t source_value{ 0 };
+		uint32_t operand1{ 0 };
+		uint32_t operand2{ 0 };
+	};
+
+	template <Instruction::Names N, OperandKind D, OperandKind S>
+	static constexpr Handler handler_for();
+
+	template <size_t... I>
+	static constexpr std::array<Handler, sizeof...(I)> make_handlers(std::index_sequence<I...>);
+
+	static uint8_t bind_handler(const Instruction& instruction);
+
+	using PairCounts = std::array<size_t, 0x10000>;
+
+	std::unique_ptr<PairCounts> pair_counts;
+	uint8_t previous_handler{ 0 };
+
+	// Superinstructions run two adjacent block entries as one handler,
+	// leaving out what the second makes moot, such as flags it overwrites.
+	// They stand in for the pair only below bus-cycle accuracy, where
+	// nothing is driven between the two.
+	using FusedHandler = void (Soft80::*)(const CachedInstruction* entries, const BasicBlock& block);
+
+	static uint8_t bind_fused(uint8_t first, uint8_t second);
+	void fuse_block(BasicBlock* block);
+	void execute_fused(const CachedInstruction* entries, const BasicBlock& block);
+	void enter_fused(const CachedInstruction& entry);
+	void retire_fused(const CachedInstruction& entry, bool taken);
+
+	void fused_NOP_NOP(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_DEC_JP(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_DEC_JR(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_LD_DEC(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_LD_INC(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_LD_OUT(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_PUSH_PUSH(const CachedInstruction* entries, const BasicBlock& block);
+	void fused_POP_POP(const CachedInstruction* entries, const BasicBlock& block);
+
+	uint8_t current_handler{ 0 };
+	DecodeEntry::Timing current_timing;
+
+	// Which cost of current_timing applies, set while the handler runs.
+	bool branch_taken{ false };
+	bool block_repeats{ false };
 
-	std::stack<Instruction> instruction_history;
+	// An IM 0 vector byte is read without a memory cycle.
+	bool vector_fetch{ false };
 
 	void execute_instruction();
+	void load_cached(const CachedInstruction& entry);
+	void repeat_instruction();
+
+	// The last flag-producing operation, kept so that F is only computed
+	// when something reads it. Anything that reads registers.main.F directly
+	// must call materialize_flags() first.
+	struct LazyFlags {
+		enum class Kind {
+			None,
+			Arithmetic,
+			IncDec,
+			Parity,
+			Undocumented
+		};
+
+		Kind kind{ Kind::None };
+		bool wide{ false };
+		uint8_t fixed{ 0 };
+		uint32_t result{ 0 };
+		uint32_t operand1{ 0 };
+		uint32_t operand2{ 0 };
+	};
+
+	LazyFlags lazy_flags;
+
+	uint8_t materialize_flags();
+	void set_flags(uint8_t value);
+	void defer_flags(LazyFlags::Kind kind, uint32_t result, uint32_t operand1, uint32_t operand2, bool wide, uint8_t fixed);
+
+	template <OperandKind D, OperandKind S>
+	Operands fetch_operands(const Instruction& instruction);
+
+	template <OperandKind D>
+	void write_result(const Instruction& instruction, uint16_t dest_value, uint32_t result);
+
+	template <OperandKind S>
+	void write_source(const Instruction& instruction, const Operands& operands, uint8_t value);
+
+	template <OperandKind D>
+	void finish(const Instruction& instruction, const Operands& operands, uint32_t result);
+
+	bool condition_met(Instruction::Conditions condition);
+	void push_word(uint16_t value);
+	uint16_t pop_word();
+
+	template <OperandKind D, OperandKind S>
+	bool block_compare(const Instruction& instruction, int delta);
+
+	bool bulk_block_compare(int delta, uint8_t opcode);
+
+	template <OperandKind D, OperandKind S>
+	uint16_t block_load(const Instruction& instruction, int delta, bool repeat);
+
+	uint16_t bulk_block_load(int delta, uint8_t opcode);
+
+	template <OperandKind D, OperandKind S>
+	uint8_t block_input(const Instruction& instruction, int delta);
+
+	template <OperandKind D, OperandKind S>
+	uint8_t block_output(const Instruction& instruction, int delta);
+
+	uint8_t bulk_block_io(int delta, uint8_t opcode, bool input);
+
+	template <OperandKind D, OperandKind S>
+	void rotate_left(const Instruction& instruction, const Operands& o, uint32_t value, bool carry_in, bool accumulator);
+
+	template <OperandKind D, OperandKind S>
+	void rotate_right(const Instruction& instruction, const Operands& o, uint32_t value, uint32_t high_bits, bool accumulator);
+
+	template <OperandKind D, OperandKind S>
+	void op_ADC(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_ADD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_AND(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_BIT(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CALL(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CCF(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CP(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CPD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CPDR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CPI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CPIR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_CPL(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_DAA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_DEC(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_DI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_DJNZ(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_EI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_EX(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_EXX(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_HALT(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_IM(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_IN(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_INC(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_IND(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_INDR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_INI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_INIR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_JP(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_JR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_LD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_LDD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_LDDR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_LDI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_LDIR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_NEG(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_NOP(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_OR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_OTDR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_OTIR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_OUT(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_OUTD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_OUTI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_POP(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_PUSH(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RES(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RET(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RETI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RETN(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RL(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RLA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RLC(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RLCA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RLD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RRA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RRC(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RRCA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RRD(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RST(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SBC(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SCF(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SET(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SLA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SRA(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SLL(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SRL(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SUB(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_XOR(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_NONI(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RLCalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RRCalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RLalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RRalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SLAalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SRAalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SLLalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SRLalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_RESalt(const Instruction& instruction);
+
+	template <OperandKind D, OperandKind S>
+	void op_SETalt(const Instruction& instruction);
 
 	RegisterFile registers;
 	Decoder decoder;
+	InstructionCache instruction_cache;
+
+	uint16_t fetch_start{ 0 };
+	size_t fetch_stamp{ 0 };
+	bool fetch_cacheable{ false };
+	std::array<uint8_t, 4> fetch_bytes{};
 
 	std::optional<Instruction> current_instruction{ std::nullopt };
 
 	size_t total_t_cycles{ 0 };
 	size_t current_t_cycles{ 0 };
 
+	// With instruction-cycle accuracy under cycle_clock(), the executor runs
+	// each instruction at once and then pays for it out of the clock credit.
+	size_t clock_debt{ 0 };
+
+	void charge_t_cycles(size_t t_cycles);
+	void catch_up_clock();
+
 	enum class M_Cycles {
 		OpcodeFetch,
 		MemRead,
@@ -91,20 +712,11 @@ private:
 
 	void update_m_cycle(M_Cycles next_cycle);
 
-	bool busack{ false };
-	bool halt{ false };
-	bool iorq{ false };
-	bool m1{ false };
-	bool mreq{ false };
-	bool rd{ false };
-	bool wr{ false };
-	bool rfsh{ false };
-
 	bool iff1{ false };
 	bool iff2{ false };
 
-	std::atomic<bool> nmi_latch{ false };
-	std::atomic<bool> int_latch{ false };
+	void set_event(uint32_t bit, bool asserted);
+	bool take_event(uint32_t bit);
 
 	bool int_response{ false };
 	std::optional<uint8_t> int_vector{ std::nullopt };
@@ -115,8 +727,4 @@ private:
 	bool read_reset();
 	bool read_wait();
 
-	std::vector<bool*> busreq_sources;
-	std::vector<bool*> reset_sources;
-	std::vector<bool*> wait_sources;
-
 };
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "soft80.h"
+
+#include <cstdint>
+
+// Entry points for translation units generated by soft80-aot. Generated
+// block functions run with the same restrictions as recompiled code: no
+// pin activity, and T-states charged per instruction.
+class StaticCode {
+
+public:
+
+	static RegisterFile& registers(Soft80& cpu) {
+		return cpu.registers;
+	}
+
+	static void charge(Soft80& cpu, size_t t_cycles) {
+		cpu.total_t_cycles += t_cycles;
+		cpu.current_t_cycles += t_cycles;
+	}
+
+	static uint8_t read(Soft80& cpu, uint16_t address) {
+		return cpu.memory.read(address);
+	}
+
+	// Returns false once the write has invalidated the running block.
+	static bool write(Soft80& cpu, uint16_t address, uint8_t value) {
+		cpu.memory.write(address, value);
+
+		return cpu.active_block->valid;
+	}
+
+	// Runs one instruction through the interpreter, with PC at its address.
+	static bool interpret(Soft80& cpu, const CachedInstruction& entry) {
+		cpu.execute_cached(entry);
+		cpu.materialize_flags();
+
+		return cpu.active_block->valid;
+	}
+
+	static constexpr uint8_t inc_dec_flags(uint32_t result, bool subtract) {
+		uint8_t flags = result & (FlagBits::Sign | FlagBits::F5 | FlagBits::F3);
+
+		if (result == 0) {
+			flags |= FlagBits::Zero;
+		}
+
+		if (result & 0xFFFFFF00) {
+			flags |= FlagBits::Overflow;
+		}
+
+		if (subtract) {
+			flags |= FlagBits::Subtract;
+		}
+
+		return flags;
+	}
+
+	static CachedInstruction entry(
+		Instruction::Names name,
+		RegisterFile::Names dest, bool addr_dest,
+		RegisterFile::Names source, bool addr_source,
+		Instruction::Conditions condition,
+		int8_t displacement, uint16_t imm, uint8_t length,
+		std::array<uint8_t, 4> bytes) {
+
+		CachedInstruction ret;
+
+		ret.instruction.name = name;
+		ret.instruction.dest = dest;
+		ret.instruction.addr_dest = addr_dest;
+		ret.instruction.source = source;
+		ret.instruction.addr_source = addr_source;
+		ret.instruction.condition = condition;
+		ret.instruction.displacement = displacement;
+		ret.instruction.imm = imm;
+		ret.length = length;
+		ret.handler = Soft80::bind_handler(ret.instruction);
+		ret.timing = Decoder::timing_of(ret.instruction, length);
+		ret.bytes = bytes;
+
+		return ret;
+	}
+
+};
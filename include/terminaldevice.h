@@ -6,6 +6,8 @@
 #include <thread>
 #include <cstdint>
 #include <iostream>
+#include <algorithm>
+#include <span>
 
 class TerminalDevice {
 
@@ -19,12 +21,22 @@ public:
 		std::cout << b;
 	}
 
+	void read_block(uint8_t port_lo, uint8_t port_hi, std::span<uint8_t> data) {
+		std::fill(data.begin(), data.end(), 0);
+	}
+
+	void write_block(uint8_t port_lo, uint8_t port_hi, std::span<const uint8_t> data) {
+		std::cout.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
+
 };
 
 class NMITerminalDevice : public InterruptingDevice {
 
 public:
 
+	using InterruptingDevice::InterruptingDevice;
+
 	uint8_t read(uint8_t port_lo, uint8_t port_hi) override {
 		if (needs_len) {
 			needs_len = false;
@@ -72,6 +84,8 @@ class INT0TerminalDevice : public InterruptingDevice {
 
 public:
 
+	using InterruptingDevice::InterruptingDevice;
+
 	uint8_t read(uint8_t port_lo, uint8_t port_hi) override {
 		if (needs_len) {
 			needs_len = false;
@@ -107,7 +121,7 @@ private:
 
 			wait_cpu_int_ack();
 
-			zcpu->data_bus = 0xF7;
+			zcpu->place_vector(0xF7);
 
 			should_read = false;
 		}
@@ -123,6 +137,8 @@ class INT1TerminalDevice : public InterruptingDevice {
 
 public:
 
+	using InterruptingDevice::InterruptingDevice;
+
 	uint8_t read(uint8_t port_lo, uint8_t port_hi) override {
 		if (needs_len) {
 			needs_len = false;
@@ -170,6 +186,8 @@ class INT2TerminalDevice : public InterruptingDevice {
 
 public:
 
+	using InterruptingDevice::InterruptingDevice;
+
 	uint8_t read(uint8_t port_lo, uint8_t port_hi) override {
 		if (needs_len) {
 			needs_len = false;
@@ -203,13 +221,13 @@ private:
 
 			zcpu->signal_int();
 			wait_cpu_int_ack();
-			zcpu->data_bus = 0;
+			zcpu->place_vector(0);
 
 			wait_cpu_halt();
 
 			zcpu->signal_int();
 			wait_cpu_int_ack();
-			zcpu->data_bus = 2;
+			zcpu->place_vector(2);
 
 			should_read = false;
 		}
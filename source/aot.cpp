@@ -0,0 +1,764 @@
+// soft80-aot: translates the code reachable in a ROM image into a C++
+// translation unit of StaticBlocks.
+//
+// usage: soft80-aot <rom.bin> <output.cpp> <register_function> [base_address]
+//
+// The output defines `void <register_function>(Soft80& cpu)`, which hands
+// the blocks to Soft80::add_static_blocks(). Blocks are cut exactly where
+// Soft80 cuts them at run time, so the two can be matched by address.
+
+#include "decoder.h"
+#include "blockcache.h"
+#include "util.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <optional>
+#include <cstdio>
+#include <cstdint>
+
+namespace {
+
+	const char* instruction_names[]{
+		"ADC", "ADD", "AND", "BIT", "CALL", "CCF", "CP", "CPD", "CPDR", "CPI", "CPIR", "CPL", "DAA",
+		"DEC", "DI", "DJNZ", "EI", "EX", "EXX", "HALT", "IM", "IN", "INC", "IND", "INDR", "INI", "INIR",
+		"JP", "JR", "LD", "LDD", "LDDR", "LDI", "LDIR", "NEG", "NOP", "OR", "OTDR", "OTIR", "OUT", "OUTD",
+		"OUTI", "POP", "PUSH", "RES", "RET", "RETI", "RETN", "RL", "RLA", "RLC", "RLCA", "RLD", "RR",
+		"RRA", "RRC", "RRCA", "RRD", "RST", "SBC", "SCF", "SET", "SLA", "SRA", "SLL", "SRL", "SUB", "XOR",
+		"NONI", "RLCalt", "RRCalt", "RLalt", "RRalt", "SLAalt", "SRAalt", "SLLalt", "SRLalt",
+		"RESalt", "SETalt"
+	};
+
+	const char* register_names[]{
+		"A", "B", "C", "D", "E", "F", "H", "L",
+		"AF", "BC", "DE", "HL", "SP",
+		"Aalt", "Balt", "Calt", "Dalt", "Ealt", "Falt", "Halt", "Lalt",
+		"AFalt", "BCalt", "DEalt", "HLalt",
+		"IXH", "IXL", "IX", "IYH", "IYL", "IY", "I", "R",
+		"Immediate", "None"
+	};
+
+	const char* condition_names[]{
+		"NZ", "Z", "NC", "C", "PO", "PE", "P", "M", "None"
+	};
+
+	struct Image {
+		std::vector<uint8_t> bytes;
+		uint16_t base{ 0 };
+
+		bool contains(uint16_t address) const {
+			return static_cast<uint16_t>(address - base) < bytes.size();
+		}
+
+		uint8_t at(uint16_t address) const {
+			return bytes[static_cast<uint16_t>(address - base)];
+		}
+	};
+
+	struct Block {
+		uint16_t start{ 0 };
+		uint16_t end{ 0 };
+
+		std::vector<CachedInstruction> instructions;
+	};
+
+	std::string hex(uint32_t value, int digits) {
+		char buffer[16];
+
+		std::snprintf(buffer, sizeof(buffer), "0x%0*X", digits, value);
+
+		return buffer;
+	}
+
+	// Mirrors Soft80::build_block(), minus breakpoints.
+	std::optional<Block> build_block(const Image& image, uint16_t address) {
+		Block block;
+
+		block.start = address;
+
+		Decoder decoder;
+
+		uint16_t pc = address;
+
+		while (block.instructions.size() < BlockCache::MaxInstructions) {
+			CachedInstruction entry;
+
+			std::optional<Instruction> decoded;
+
+			do {
+				uint16_t byte_address = pc + entry.length;
+
+				if (!image.contains(byte_address)) {
+					break;
+				}
+
+				entry.bytes[entry.length] = image.at(byte_address);
+				decoded = decoder.decode(entry.bytes[entry.length]);
+				entry.length++;
+			} while (!decoded);
+
+			if (!decoded || !decoder.is_idle()) {
+				break;
+			}
+
+			entry.instruction = decoded.value();
+
+			block.instructions.push_back(entry);
+
+			pc += entry.length;
+
+			if (BasicBlock::is_terminator(entry.instruction)) {
+				break;
+			}
+		}
+
+		if (block.instructions.empty()) {
+			return std::nullopt;
+		}
+
+		block.end = pc;
+
+		return block;
+	}
+
+	// Addresses control can reach from the end of a block.
+	std::vector<uint16_t> successors(const Block& block) {
+		std::vector<uint16_t> ret;
+
+		const Instruction& last = block.instructions.back().instruction;
+
+		uint16_t last_address = block.end - block.instructions.back().length;
+
+		bool conditional = last.condition != Instruction::Conditions::None;
+
+		switch (last.name) {
+		case Instruction::Names::JP:
+			if (last.dest == RegisterFile::Names::Immediate) {
+				ret.push_back(last.imm);
+			}
+
+			if (conditional) {
+				ret.push_back(block.end);
+			}
+
+			break;
+
+		case Instruction::Names::JR:
+			ret.push_back(static_cast<uint16_t>(block.end + last.displacement));
+
+			if (conditional) {
+				ret.push_back(block.end);
+			}
+
+			break;
+
+		case Instruction::Names::DJNZ:
+			ret.push_back(static_cast<uint16_t>(block.end + last.displacement));
+			ret.push_back(block.end);
+			break;
+
+		case Instruction::Names::CALL:
+		case Instruction::Names::RST:
+			ret.push_back(last.imm);
+			ret.push_back(block.end);
+			break;
+
+		case Instruction::Names::RET:
+			if (conditional) {
+				ret.push_back(block.end);
+			}
+
+			break;
+
+		case Instruction::Names::RETI:
+		case Instruction::Names::RETN:
+			break;
+
+		case Instruction::Names::CPDR:
+		case Instruction::Names::CPIR:
+		case Instruction::Names::INDR:
+		case Instruction::Names::INIR:
+		case Instruction::Names::LDDR:
+		case Instruction::Names::LDIR:
+		case Instruction::Names::OTDR:
+		case Instruction::Names::OTIR:
+			ret.push_back(last_address);
+			ret.push_back(block.end);
+			break;
+
+		default:
+			ret.push_back(block.end);
+			break;
+		}
+
+		return ret;
+	}
+
+	// Pages loaded into I through LD A,n; LD I,A.
+	std::vector<uint16_t> im2_tables(const Block& block) {
+		std::vector<uint16_t> ret;
+
+		uint8_t a_value = 0;
+		bool a_known = false;
+
+		for (const CachedInstruction& entry : block.instructions) {
+			const Instruction& instruction = entry.instruction;
+
+			if (instruction.name != Instruction::Names::LD) {
+				continue;
+			}
+
+			if (instruction.dest == RegisterFile::Names::A) {
+				a_known = instruction.source == RegisterFile::Names::Immediate && !instruction.addr_source;
+
+				if (a_known) {
+					a_value = instruction.imm_low;
+				}
+			}
+			else if (instruction.dest == RegisterFile::Names::I && instruction.source == RegisterFile::Names::A && a_known) {
+				ret.push_back(a_value << 8);
+			}
+		}
+
+		return ret;
+	}
+
+	std::map<uint16_t, Block> walk(const Image& image) {
+		std::map<uint16_t, Block> blocks;
+
+		std::deque<uint16_t> pending;
+		std::set<uint16_t> seen;
+		std::set<uint16_t> tables;
+
+		auto visit = [&](uint16_t address) {
+			if (image.contains(address) && seen.insert(address).second) {
+				pending.push_back(address);
+			}
+		};
+
+		visit(0x0000);
+		visit(0x0066);
+
+		for (uint16_t rst = 0x0008; rst <= 0x0038; rst += 8) {
+			visit(rst);
+		}
+
+		while (!pending.empty()) {
+			while (!pending.empty()) {
+				uint16_t address = pending.front();
+				pending.pop_front();
+
+				std::optional<Block> block = build_block(image, address);
+
+				if (!block) {
+					continue;
+				}
+
+				for (uint16_t next : successors(block.value())) {
+					visit(next);
+				}
+
+				for (uint16_t table : im2_tables(block.value())) {
+					tables.insert(table);
+				}
+
+				blocks[address] = std::move(block.value());
+			}
+
+			for (uint16_t table : tables) {
+				for (uint16_t vector = 0; vector < 0x100; vector += 2) {
+					uint16_t low = table | vector;
+					uint16_t high = table | (vector + 1);
+
+					if (image.contains(low) && image.contains(high)) {
+						visit(image.at(low) | (image.at(high) << 8));
+					}
+				}
+			}
+		}
+
+		return blocks;
+	}
+
+	class Emitter {
+
+	public:
+
+		Emitter(std::ostream& out) : out(out) {}
+
+		void block(const Block& block) {
+			std::string name = "block_" + hex(block.start, 4).substr(2);
+
+			std::vector<std::string> entries;
+
+			std::ostringstream body;
+
+			uint16_t address = block.start;
+
+			pending_t_cycles = 0;
+
+			bool ended_in_interpreter = false;
+			bool sets_pc = false;
+
+			for (size_t i = 0; i < block.instructions.size(); i++) {
+				const CachedInstruction& entry = block.instructions[i];
+
+				uint16_t next = address + entry.length;
+
+				body << "\n\t// " << hex(address, 4) << ": " << describe(entry.instruction) << "\n";
+
+				if (emit_native(body, entry, next)) {
+					sets_pc = is_branch(entry.instruction);
+					ended_in_interpreter = false;
+				}
+				else {
+					flush(body);
+
+					body << "\tr.PC = " << hex(address, 4) << ";\n";
+
+					if (i + 1 == block.instructions.size()) {
+						body << "\tStaticCode::interpret(cpu, " << name << "_code[" << entries.size() << "]);\n";
+					}
+					else {
+						body << "\tif (!StaticCode::interpret(cpu, " << name << "_code[" << entries.size() << "])) return;\n";
+					}
+
+					entries.push_back(entry_initializer(entry));
+
+					ended_in_interpreter = true;
+				}
+
+				address = next;
+			}
+
+			if (!ended_in_interpreter) {
+				body << "\n";
+
+				flush(body);
+
+				if (!sets_pc) {
+					body << "\tr.PC = " << hex(block.end, 4) << ";\n";
+				}
+			}
+
+			out << "const uint8_t " << name << "_bytes[]{";
+
+			for (uint16_t i = 0; i < static_cast<uint16_t>(block.end - block.start); i++) {
+				out << (i % 16 == 0 ? "\n\t" : " ") << hex(image_bytes->at(block.start + i), 2) << ",";
+			}
+
+			out << "\n};\n\n";
+
+			if (!entries.empty()) {
+				out << "const CachedInstruction " << name << "_code[]{\n";
+
+				for (const std::string& entry : entries) {
+					out << "\t" << entry << ",\n";
+				}
+
+				out << "};\n\n";
+			}
+
+			out << "void " << name << "(Soft80& cpu) {\n";
+			out << "\tRegisterFile& r = StaticCode::registers(cpu);\n";
+			out << body.str();
+			out << "}\n\n";
+
+			names.push_back({ block.start, block.end, name });
+		}
+
+		void table(const std::string& function) {
+			out << "const StaticBlock blocks[]{\n";
+
+			for (const auto& [start, end, name] : names) {
+				out << "\t{ " << hex(start, 4) << ", " << hex(end, 4) << ", " << name << "_bytes, &" << name << " },\n";
+			}
+
+			out << "};\n\n";
+			out << "}\n\n";
+			out << "void " << function << "(Soft80& cpu) {\n";
+			out << "\tcpu.add_static_blocks(blocks, std::size(blocks));\n";
+			out << "}\n";
+		}
+
+		const Image* image_bytes{ nullptr };
+
+	private:
+
+		struct Entry {
+			uint16_t start;
+			uint16_t end;
+			std::string name;
+		};
+
+		std::ostream& out;
+		std::vector<Entry> names;
+
+		uint32_t pending_t_cycles{ 0 };
+
+		void flush(std::ostream& body) {
+			if (pending_t_cycles > 0) {
+				body << "\tStaticCode::charge(cpu, " << pending_t_cycles << ");\n";
+			}
+
+			pending_t_cycles = 0;
+		}
+
+		static bool is_branch(const Instruction& instruction) {
+			return instruction.name == Instruction::Names::JP
+				|| instruction.name == Instruction::Names::JR
+				|| instruction.name == Instruction::Names::DJNZ;
+		}
+
+		static std::optional<std::string> lvalue(RegisterFile::Names name) {
+			switch (name) {
+			case RegisterFile::Names::A: return "r.main.A";
+			case RegisterFile::Names::B: return "r.main.B";
+			case RegisterFile::Names::C: return "r.main.C";
+			case RegisterFile::Names::D: return "r.main.D";
+			case RegisterFile::Names::E: return "r.main.E";
+			case RegisterFile::Names::H: return "r.main.H";
+			case RegisterFile::Names::L: return "r.main.L";
+			case RegisterFile::Names::BC: return "r.main.BC";
+			case RegisterFile::Names::DE: return "r.main.DE";
+			case RegisterFile::Names::HL: return "r.main.HL";
+			case RegisterFile::Names::SP: return "r.SP";
+			case RegisterFile::Names::IX: return "r.IX";
+			case RegisterFile::Names::IY: return "r.IY";
+			case RegisterFile::Names::IXH: return "r.IXH";
+			case RegisterFile::Names::IXL: return "r.IXL";
+			case RegisterFile::Names::IYH: return "r.IYH";
+			case RegisterFile::Names::IYL: return "r.IYL";
+			default: break;
+			}
+
+			return std::nullopt;
+		}
+
+		static bool is_operand(RegisterFile::Names name) {
+			return lvalue(name) || name == RegisterFile::Names::Immediate || name == RegisterFile::Names::None;
+		}
+
+		static std::string value(const Instruction& instruction, RegisterFile::Names name) {
+			if (name == RegisterFile::Names::Immediate) {
+				return hex(instruction.imm, 4);
+			}
+
+			if (name == RegisterFile::Names::None) {
+				return "0";
+			}
+
+			return lvalue(name).value();
+		}
+
+		static std::string condition(Instruction::Conditions condition) {
+			switch (condition) {
+			case Instruction::Conditions::NZ: return "!(r.main.F & FlagBits::Zero)";
+			case Instruction::Conditions::Z: return "(r.main.F & FlagBits::Zero)";
+			case Instruction::Conditions::NC: return "!(r.main.F & FlagBits::Carry)";
+			case Instruction::Conditions::C: return "(r.main.F & FlagBits::Carry)";
+			case Instruction::Conditions::PO: return "!(r.main.F & FlagBits::Overflow)";
+			case Instruction::Conditions::PE: return "(r.main.F & FlagBits::Overflow)";
+			case Instruction::Conditions::P: return "!(r.main.F & FlagBits::Sign)";
+			case Instruction::Conditions::M: return "(r.main.F & FlagBits::Sign)";
+			default: break;
+			}
+
+			return "true";
+		}
+
+		static std::string describe(const Instruction& instruction) {
+			std::string ret = instruction_names[static_cast<int>(instruction.name)];
+
+			if (instruction.condition != Instruction::Conditions::None) {
+				ret += std::string(" ") + condition_names[static_cast<int>(instruction.condition)];
+			}
+
+			for (auto [name, addr] : { std::pair{ instruction.dest, instruction.addr_dest }, std::pair{ instruction.source, instruction.addr_source } }) {
+				if (name == RegisterFile::Names::None) {
+					continue;
+				}
+
+				std::string operand = name == RegisterFile::Names::Immediate
+					? hex(instruction.imm, 4)
+					: register_names[static_cast<int>(name)];
+
+				ret += addr ? " (" + operand + ")" : " " + operand;
+			}
+
+			return ret;
+		}
+
+		static std::string entry_initializer(const CachedInstruction& entry) {
+			const Instruction& instruction = entry.instruction;
+
+			std::ostringstream ret;
+
+			ret << "StaticCode::entry("
+				<< "Instruction::Names::" << instruction_names[static_cast<int>(instruction.name)] << ", "
+				<< "RegisterFile::Names::" << register_names[static_cast<int>(instruction.dest)] << ", "
+				<< (instruction.addr_dest ? "true" : "false") << ", "
+				<< "RegisterFile::Names::" << register_names[static_cast<int>(instruction.source)] << ", "
+				<< (instruction.addr_source ? "true" : "false") << ", "
+				<< "Instruction::Conditions::" << condition_names[static_cast<int>(instruction.condition)] << ", "
+				<< static_cast<int>(instruction.displacement) << ", "
+				<< hex(instruction.imm, 4) << ", "
+				<< static_cast<int>(entry.length) << ", {";
+
+			for (uint8_t i = 0; i < entry.length; i++) {
+				ret << (i ? ", " : " ") << hex(entry.bytes[i], 2);
+			}
+
+			ret << " })";
+
+			return ret.str();
+		}
+
+		// Writes the result back the way the interpreter does.
+		void write_back(std::ostream& code, const Instruction& instruction, uint16_t next, const std::string& result) {
+			if (instruction.addr_dest) {
+				pending_t_cycles += 3;
+
+				flush(code);
+
+				if (!is_branch(instruction)) {
+					code << "\tr.PC = " << hex(next, 4) << ";\n";
+				}
+
+				code << "\tif (!StaticCode::write(cpu, dest_value, static_cast<uint8_t>(" << result << "))) return;\n";
+			}
+			else if (lvalue(instruction.dest)) {
+				const char* type = RegisterFile::is_16bit(instruction.dest) ? "uint16_t" : "uint8_t";
+
+				code << "\t" << lvalue(instruction.dest).value() << " = static_cast<" << type << ">(" << result << ");\n";
+			}
+		}
+
+		bool emit_native(std::ostream& body, const CachedInstruction& entry, uint16_t next) {
+			using Names = Instruction::Names;
+			using Regs = RegisterFile::Names;
+
+			const Instruction& instruction = entry.instruction;
+
+			if (!is_operand(instruction.dest) || !is_operand(instruction.source)) {
+				return false;
+			}
+
+			std::string displacement = std::to_string(instruction.displacement);
+			std::string target = hex(static_cast<uint16_t>(next + instruction.displacement), 4);
+
+			bool plain = !instruction.addr_dest && !instruction.addr_source;
+
+			uint32_t t_cycles = 4 * entry.length;
+
+			std::ostringstream code;
+
+			switch (instruction.name) {
+			case Names::NOP:
+				if (!plain) {
+					return false;
+				}
+
+				code << "\tr.main.F = 0;\n";
+
+				break;
+
+			case Names::LD:
+				if (instruction.dest == Regs::None
+					|| (instruction.dest == Regs::Immediate && !instruction.addr_dest)) {
+					return false;
+				}
+
+				if (instruction.addr_dest) {
+					code << "\tuint16_t dest_value = " << value(instruction, instruction.dest) << ";\n";
+					code << "\tStaticCode::read(cpu, dest_value + " << displacement << ");\n";
+
+					t_cycles += 3;
+				}
+
+				if (instruction.addr_source) {
+					code << "\tuint32_t operand2 = StaticCode::read(cpu, " << value(instruction, instruction.source) << " + " << displacement << ");\n";
+
+					t_cycles += 3;
+				}
+				else {
+					code << "\tuint32_t operand2 = " << value(instruction, instruction.source) << ";\n";
+				}
+
+				code << "\tr.main.F = 0;\n";
+
+				pending_t_cycles += t_cycles;
+
+				write_back(code, instruction, next, "operand2");
+
+				body << "\t{\n" << indent(code.str()) << "\t}\n";
+
+				return true;
+
+			case Names::EX:
+				if (!plain || instruction.dest != Regs::DE || instruction.source != Regs::HL) {
+					return false;
+				}
+
+				code << "\tstd::swap(r.main.DE, r.main.HL);\n";
+				code << "\tr.main.F = 0;\n";
+
+				break;
+
+			case Names::INC:
+			case Names::DEC:
+			{
+				if (instruction.source != Regs::None || instruction.addr_source || !lvalue(instruction.dest)) {
+					return false;
+				}
+
+				const char* op = instruction.name == Names::INC ? " + 1" : " - 1";
+
+				if (instruction.addr_dest) {
+					code << "\tuint16_t dest_value = " << value(instruction, instruction.dest) << ";\n";
+					code << "\tuint32_t result = static_cast<uint32_t>(StaticCode::read(cpu, dest_value + " << displacement << "))" << op << ";\n";
+
+					t_cycles += 3;
+				}
+				else {
+					code << "\tuint32_t result = static_cast<uint32_t>(" << value(instruction, instruction.dest) << ")" << op << ";\n";
+				}
+
+				code << "\tr.main.F = StaticCode::inc_dec_flags(result, " << (instruction.name == Names::DEC ? "true" : "false") << ");\n";
+
+				pending_t_cycles += t_cycles;
+
+				write_back(code, instruction, next, "result");
+
+				body << "\t{\n" << indent(code.str()) << "\t}\n";
+
+				return true;
+			}
+
+			case Names::JP:
+				if (instruction.source != Regs::None || instruction.addr_source || instruction.dest == Regs::None) {
+					return false;
+				}
+
+				code << "\tuint16_t dest_value = " << value(instruction, instruction.dest) << ";\n";
+
+				if (instruction.addr_dest) {
+					code << "\tStaticCode::read(cpu, dest_value + " << displacement << ");\n";
+
+					t_cycles += 3;
+				}
+
+				code << "\tr.PC = " << condition(instruction.condition) << " ? dest_value : " << hex(next, 4) << ";\n";
+				code << "\tr.main.F = 0;\n";
+
+				pending_t_cycles += t_cycles;
+
+				write_back(code, instruction, next, "0");
+
+				body << "\t{\n" << indent(code.str()) << "\t}\n";
+
+				return true;
+
+			case Names::JR:
+				if (!plain || instruction.dest != Regs::None || instruction.source != Regs::None) {
+					return false;
+				}
+
+				// Taken regardless of the condition, as in the interpreter.
+				code << "\tr.PC = " << target << ";\n";
+				code << "\tr.main.F = 0;\n";
+
+				break;
+
+			case Names::DJNZ:
+				if (!plain || instruction.dest != Regs::None || instruction.source != Regs::None) {
+					return false;
+				}
+
+				code << "\tr.main.B = r.main.B - 1;\n";
+				code << "\tr.PC = r.main.B != 0 ? " << target << " : " << hex(next, 4) << ";\n";
+				code << "\tr.main.F = 0;\n";
+
+				break;
+
+			default:
+				return false;
+			}
+
+			pending_t_cycles += t_cycles;
+
+			body << code.str();
+
+			return true;
+		}
+
+		static std::string indent(const std::string& code) {
+			std::string ret;
+
+			std::istringstream lines(code);
+
+			for (std::string line; std::getline(lines, line);) {
+				ret += "\t" + line + "\n";
+			}
+
+			return ret;
+		}
+
+	};
+
+}
+
+int main(int argc, char** argv) {
+
+	if (argc < 4) {
+		std::cerr << "usage: soft80-aot <rom.bin> <output.cpp> <register_function> [base_address]\n";
+		return 1;
+	}
+
+	Image image;
+
+	image.bytes = load_bin_file(argv[1]);
+
+	if (argc > 4) {
+		image.base = static_cast<uint16_t>(std::stoul(argv[4], nullptr, 0));
+	}
+
+	if (image.bytes.size() > 0x10000) {
+		image.bytes.resize(0x10000);
+	}
+
+	std::map<uint16_t, Block> blocks = walk(image);
+
+	std::ofstream out(argv[2]);
+
+	if (!out) {
+		std::cerr << "soft80-aot: cannot write " << argv[2] << "\n";
+		return 1;
+	}
+
+	out << "// Generated by soft80-aot from " << std::filesystem::path(argv[1]).filename().string() << ". Do not edit.\n\n";
+	out << "#include \"staticcode.h\"\n\n";
+	out << "#include <iterator>\n";
+	out << "#include <utility>\n\n";
+	out << "namespace {\n\n";
+
+	Emitter emitter(out);
+
+	emitter.image_bytes = &image;
+
+	for (const auto& [start, block] : blocks) {
+		emitter.block(block);
+	}
+
+	emitter.table(argv[3]);
+
+	std::cout << "soft80-aot: " << blocks.size() << " blocks from " << argv[1] << "\n";
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+#include "fiber.h"
+
+#if defined(_WIN32)
+#define SOFT80_FIBER_WIN32 1
+#include <windows.h>
+#elif defined(__x86_64__) && defined(__ELF__)
+#define SOFT80_FIBER_X64 1
+#else
+#define SOFT80_FIBER_UCONTEXT 1
+#include <ucontext.h>
+#endif
+
+#include <cstdint>
+
+#if SOFT80_FIBER_X64
+
+// Saves the callee-saved registers on the current stack, stores the stack
+// pointer through save and continues on the stack at load. Nothing else
+// needs saving between calls on one thread, so there is no system call.
+extern "C" void soft80_switch_stack(void** save, void* load);
+
+// Where a new fiber's first switch returns to, with the fiber in R12.
+extern "C" void soft80_fiber_start();
+
+asm(R"(
+	.text
+	.globl soft80_switch_stack
+	.type soft80_switch_stack, @function
+soft80_switch_stack:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size soft80_switch_stack, .-soft80_switch_stack
+
+	.globl soft80_fiber_start
+	.type soft80_fiber_start, @function
+soft80_fiber_start:
+	movq %r12, %rdi
+	call soft80_fiber_main
+	ud2
+	.size soft80_fiber_start, .-soft80_fiber_start
+)");
+
+struct Fiber::Context {
+	void* fiber_sp{ nullptr };
+	void* caller_sp{ nullptr };
+};
+
+#elif SOFT80_FIBER_WIN32
+
+struct Fiber::Context {
+	LPVOID fiber{ nullptr };
+	LPVOID caller{ nullptr };
+};
+
+namespace {
+
+	void CALLBACK fiber_proc(LPVOID parameter) {
+		soft80_fiber_main(static_cast<Fiber*>(parameter));
+	}
+
+}
+
+#else
+
+struct Fiber::Context {
+	ucontext_t fiber;
+	ucontext_t caller;
+};
+
+namespace {
+
+	// makecontext() only passes int arguments.
+	thread_local Fiber* starting = nullptr;
+
+	void fiber_proc() {
+		soft80_fiber_main(starting);
+	}
+
+}
+
+#endif
+
+Fiber::Fiber(std::function<void()> body, size_t stack_size)
+	: body(std::move(body)), stack_size(stack_size), context(std::make_unique<Context>()) {
+
+#if SOFT80_FIBER_X64
+	stack = std::make_unique<std::byte[]>(stack_size);
+
+	uintptr_t top = reinterpret_cast<uintptr_t>(stack.get() + stack_size) & ~uintptr_t(15);
+
+	// The six registers soft80_switch_stack() pops, then the address it
+	// returns to, leaving the stack 16-byte aligned for the call.
+	void** frame = reinterpret_cast<void**>(top - 72);
+
+	for (size_t i = 0; i < 6; i++) {
+		frame[i] = nullptr;
+	}
+
+	frame[3] = this;
+	frame[6] = reinterpret_cast<void*>(&soft80_fiber_start);
+
+	context->fiber_sp = frame;
+#elif SOFT80_FIBER_WIN32
+	context->fiber = CreateFiber(stack_size, &fiber_proc, this);
+#else
+	stack = std::make_unique<std::byte[]>(stack_size);
+
+	getcontext(&context->fiber);
+
+	context->fiber.uc_stack.ss_sp = stack.get();
+	context->fiber.uc_stack.ss_size = stack_size;
+	context->fiber.uc_link = nullptr;
+
+	makecontext(&context->fiber, &fiber_proc, 0);
+#endif
+}
+
+Fiber::~Fiber() {
+	unwind();
+
+#if SOFT80_FIBER_WIN32
+	if (context->fiber) {
+		DeleteFiber(context->fiber);
+	}
+#endif
+}
+
+void Fiber::resume() {
+	if (done) {
+		return;
+	}
+
+	started = true;
+
+#if SOFT80_FIBER_X64
+	soft80_switch_stack(&context->caller_sp, context->fiber_sp);
+#elif SOFT80_FIBER_WIN32
+	if (!IsThreadAFiber()) {
+		ConvertThreadToFiber(nullptr);
+	}
+
+	context->caller = GetCurrentFiber();
+
+	SwitchToFiber(context->fiber);
+#else
+	starting = this;
+
+	swapcontext(&context->caller, &context->fiber);
+#endif
+}
+
+void Fiber::suspend() {
+#if SOFT80_FIBER_X64
+	soft80_switch_stack(&context->fiber_sp, context->caller_sp);
+#elif SOFT80_FIBER_WIN32
+	SwitchToFiber(context->caller);
+#else
+	swapcontext(&context->fiber, &context->caller);
+#endif
+
+	if (unwind_requested && !done) {
+		throw Unwind{};
+	}
+}
+
+bool Fiber::finished() const {
+	return done;
+}
+
+// A suspended body is resumed one last time, only to throw Unwind from its
+// suspend() and run the destructors on its stack.
+void Fiber::unwind() {
+	if (started && !done) {
+		unwind_requested = true;
+
+		resume();
+	}
+
+	done = true;
+}
+
+bool Fiber::unwinding() const {
+	return unwind_requested;
+}
+
+extern "C" void soft80_fiber_main(Fiber* fiber) {
+	try {
+		fiber->body();
+	}
+	catch (const Fiber::Unwind&) {
+	}
+
+	fiber->done = true;
+
+	// Never resumed again.
+	for (;;) {
+		fiber->suspend();
+	}
+}
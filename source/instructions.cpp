@@ -0,0 +1,2064 @@
+#include "soft80.h"
+#include "flagtables.h"
+#include "decodetable.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <bit>
+#include <utility>
+
+namespace {
+
+	const size_t NameCount = static_cast<size_t>(Instruction::Names::SETalt) + 1;
+	const size_t KindCount = static_cast<size_t>(OperandKind::Absolute) + 1;
+
+	constexpr bool is_register(OperandKind kind) {
+		return kind == OperandKind::Register || kind == OperandKind::Pair;
+	}
+
+	constexpr bool is_memory(OperandKind kind) {
+		return kind == OperandKind::Indirect || kind == OperandKind::Absolute;
+	}
+
+	bool is_flag_register(RegisterFile::Names name) {
+		return name == RegisterFile::Names::F || name == RegisterFile::Names::AF;
+	}
+
+	// Both operands name 16-bit registers; an indirect operand counts by its
+	// pointer, as it always has.
+	constexpr bool is_wide(OperandKind dest, OperandKind source) {
+		return (dest == OperandKind::Pair || dest == OperandKind::Indirect)
+			&& (source == OperandKind::Pair || source == OperandKind::Indirect);
+	}
+
+	uint8_t sign(uint32_t result, bool wide) {
+		return (result & (wide ? 0x00008000 : 0x00000080)) ? FlagBits::Sign : 0;
+	}
+
+	uint8_t zero(uint32_t result) {
+		return result == 0 ? FlagBits::Zero : 0;
+	}
+
+	uint8_t undocumented(uint32_t result) {
+		return result & (FlagBits::F5 | FlagBits::F3);
+	}
+
+	uint8_t half_carry(uint32_t operand1, uint32_t operand2) {
+		return (operand1 & operand2 & 0x00000008) << 1;
+	}
+
+	uint8_t parity(uint32_t result) {
+		return std::popcount(result & 0x000000FF) % 2 == 0 ? FlagBits::Overflow : 0;
+	}
+
+	uint8_t overflow(uint32_t result, bool wide) {
+		return (result & (wide ? 0xFFFF0000 : 0xFFFFFF00)) ? FlagBits::Overflow : 0;
+	}
+
+	uint8_t carry(uint32_t result, bool wide) {
+		return (result & (wide ? 0xFFFF0000 : 0xFFFFFF00)) ? FlagBits::Carry : 0;
+	}
+
+	// Sign, zero, F5, F3 and parity, as left by the logical and shift groups.
+	uint8_t szp(uint32_t result, bool wide) {
+		if (!wide && result < 0x200) {
+			return FlagTables::szp[result];
+		}
+
+		return sign(result, wide) | zero(result) | undocumented(result) | parity(result);
+	}
+
+	// Whether an add or subtract result can be looked up in
+	// FlagTables::arithmetic.
+	bool in_arithmetic_table(uint32_t result, bool wide) {
+		return !wide && result + 0x100 < 0x300;
+	}
+
+	// Flags of the arithmetic group; half carry and overflow are as loose
+	// as they have always been in this core.
+	uint8_t arithmetic(uint32_t result, uint32_t operand1, uint32_t operand2, bool wide) {
+		return sign(result, wide)
+			| zero(result)
+			| undocumented(result)
+			| half_carry(operand1, operand2)
+			| overflow(result, wide);
+	}
+
+	struct HandlerKey {
+		Instruction::Names name;
+		OperandKind dest;
+		OperandKind source;
+	};
+
+	constexpr size_t key_index(Instruction::Names name, OperandKind dest, OperandKind source) {
+		return (static_cast<size_t>(name) * KindCount + static_cast<size_t>(dest)) * KindCount + static_cast<size_t>(source);
+	}
+
+	constexpr size_t key_index(const Instruction& instruction) {
+		return key_index(
+			instruction.name,
+			operand_kind(instruction.dest, instruction.addr_dest),
+			operand_kind(instruction.source, instruction.addr_source));
+	}
+
+	using KeySet = std::array<bool, NameCount * KindCount * KindCount>;
+
+	// Every operation and operand kinds that the decoder can produce.
+	constexpr KeySet find_keys() {
+		KeySet keys{};
+
+		for (const auto& space : DecodeTable::table) {
+			for (const DecodeEntry& entry : space) {
+				if (!entry.is_prefix) {
+					keys[key_index(entry.instruction)] = true;
+				}
+			}
+		}
+
+		return keys;
+	}
+
+	constexpr KeySet keys = find_keys();
+
+	constexpr size_t HandlerCount = std::count(keys.begin(), keys.end(), true);
+
+	constexpr std::array<HandlerKey, HandlerCount> make_handler_keys() {
+		std::array<HandlerKey, HandlerCount> ret{};
+
+		size_t count = 0;
+
+		for (size_t i = 0; i < keys.size(); i++) {
+			if (keys[i]) {
+				ret[count].name = static_cast<Instruction::Names>(i / (KindCount * KindCount));
+				ret[count].dest = static_cast<OperandKind>(i / KindCount % KindCount);
+				ret[count].source = static_cast<OperandKind>(i % KindCount);
+				count++;
+			}
+		}
+
+		return ret;
+	}
+
+	constexpr std::array<HandlerKey, HandlerCount> handler_keys = make_handler_keys();
+
+	// Handler index for each key. Anything the decoder cannot produce runs
+	// as NONI.
+	constexpr std::array<uint8_t, NameCount * KindCount * KindCount> make_handler_index() {
+		std::array<uint8_t, NameCount * KindCount * KindCount> ret{};
+
+		size_t noni = 0;
+
+		for (size_t i = 0; i < HandlerCount; i++) {
+			if (handler_keys[i].name == Instruction::Names::NONI
+				&& handler_keys[i].dest == OperandKind::None
+				&& handler_keys[i].source == OperandKind::None) {
+				noni = i;
+			}
+		}
+
+		ret.fill(static_cast<uint8_t>(noni));
+
+		for (size_t i = 0; i < HandlerCount; i++) {
+			ret[key_index(handler_keys[i].name, handler_keys[i].dest, handler_keys[i].source)] = static_cast<uint8_t>(i);
+		}
+
+		return ret;
+	}
+
+	constexpr std::array<uint8_t, NameCount * KindCount * KindCount> handler_index = make_handler_index();
+
+	constexpr size_t key_index(const HandlerKey& key) {
+		return key_index(key.name, key.dest, key.source);
+	}
+
+	struct FusedKey {
+		HandlerKey first;
+		HandlerKey second;
+	};
+
+	using Names = Instruction::Names;
+	using Kind = OperandKind;
+
+	// In the order of the handlers in execute_fused(). The first three are
+	// what pair_histogram() finds most often on the test ROMs, leaving out
+	// pairs that span two blocks; the rest are common idioms.
+	constexpr std::array<FusedKey, 8> fused_keys{ {
+		{ { Names::NOP, Kind::None, Kind::None }, { Names::NOP, Kind::None, Kind::None } },
+		{ { Names::DEC, Kind::Register, Kind::None }, { Names::JP, Kind::Absolute, Kind::None } },
+		{ { Names::LD, Kind::Register, Kind::Immediate }, { Names::DEC, Kind::Register, Kind::None } },
+		{ { Names::DEC, Kind::Register, Kind::None }, { Names::JR, Kind::None, Kind::None } },
+		{ { Names::LD, Kind::Register, Kind::Indirect }, { Names::INC, Kind::Pair, Kind::None } },
+		{ { Names::LD, Kind::Register, Kind::Immediate }, { Names::OUT, Kind::Indirect, Kind::Register } },
+		{ { Names::PUSH, Kind::None, Kind::Pair }, { Names::PUSH, Kind::None, Kind::Pair } },
+		{ { Names::POP, Kind::Pair, Kind::None }, { Names::POP, Kind::Pair, Kind::None } }
+	} };
+
+	constexpr bool fused_keys_decode() {
+		for (const FusedKey& key : fused_keys) {
+			if (!keys[key_index(key.first)] || !keys[key_index(key.second)]) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static_assert(fused_keys_decode());
+
+}
+
+template <Instruction::Names N, OperandKind D, OperandKind S>
+constexpr Soft80::Handler Soft80::handler_for() {
+	using Names = Instruction::Names;
+
+	if constexpr (N == Names::ADC) {
+		return &Soft80::op_ADC<D, S>;
+	}
+	else if constexpr (N == Names::ADD) {
+		return &Soft80::op_ADD<D, S>;
+	}
+	else if constexpr (N == Names::AND) {
+		return &Soft80::op_AND<D, S>;
+	}
+	else if constexpr (N == Names::BIT) {
+		return &Soft80::op_BIT<D, S>;
+	}
+	else if constexpr (N == Names::CALL) {
+		return &Soft80::op_CALL<D, S>;
+	}
+	else if constexpr (N == Names::CCF) {
+		return &Soft80::op_CCF<D, S>;
+	}
+	else if constexpr (N == Names::CP) {
+		return &Soft80::op_CP<D, S>;
+	}
+	else if constexpr (N == Names::CPD) {
+		return &Soft80::op_CPD<D, S>;
+	}
+	else if constexpr (N == Names::CPDR) {
+		return &Soft80::op_CPDR<D, S>;
+	}
+	else if constexpr (N == Names::CPI) {
+		return &Soft80::op_CPI<D, S>;
+	}
+	else if constexpr (N == Names::CPIR) {
+		return &Soft80::op_CPIR<D, S>;
+	}
+	else if constexpr (N == Names::CPL) {
+		return &Soft80::op_CPL<D, S>;
+	}
+	else if constexpr (N == Names::DAA) {
+		return &Soft80::op_DAA<D, S>;
+	}
+	else if constexpr (N == Names::DEC) {
+		return &Soft80::op_DEC<D, S>;
+	}
+	else if constexpr (N == Names::DI) {
+		return &Soft80::op_DI<D, S>;
+	}
+	else if constexpr (N == Names::DJNZ) {
+		return &Soft80::op_DJNZ<D, S>;
+	}
+	else if constexpr (N == Names::EI) {
+		return &Soft80::op_EI<D, S>;
+	}
+	else if constexpr (N == Names::EX) {
+		return &Soft80::op_EX<D, S>;
+	}
+	else if constexpr (N == Names::EXX) {
+		return &Soft80::op_EXX<D, S>;
+	}
+	else if constexpr (N == Names::HALT) {
+		return &Soft80::op_HALT<D, S>;
+	}
+	else if constexpr (N == Names::IM) {
+		return &Soft80::op_IM<D, S>;
+	}
+	else if constexpr (N == Names::IN) {
+		return &Soft80::op_IN<D, S>;
+	}
+	else if constexpr (N == Names::INC) {
+		return &Soft80::op_INC<D, S>;
+	}
+	else if constexpr (N == Names::IND) {
+		return &Soft80::op_IND<D, S>;
+	}
+	else if constexpr (N == Names::INDR) {
+		return &Soft80::op_INDR<D, S>;
+	}
+	else if constexpr (N == Names::INI) {
+		return &Soft80::op_INI<D, S>;
+	}
+	else if constexpr (N == Names::INIR) {
+		return &Soft80::op_INIR<D, S>;
+	}
+	else if constexpr (N == Names::JP) {
+		return &Soft80::op_JP<D, S>;
+	}
+	else if constexpr (N == Names::JR) {
+		return &Soft80::op_JR<D, S>;
+	}
+	else if constexpr (N == Names::LD) {
+		return &Soft80::op_LD<D, S>;
+	}
+	else if constexpr (N == Names::LDD) {
+		return &Soft80::op_LDD<D, S>;
+	}
+	else if constexpr (N == Names::LDDR) {
+		return &Soft80::op_LDDR<D, S>;
+	}
+	else if constexpr (N == Names::LDI) {
+		return &Soft80::op_LDI<D, S>;
+	}
+	else if constexpr (N == Names::LDIR) {
+		return &Soft80::op_LDIR<D, S>;
+	}
+	else if constexpr (N == Names::NEG) {
+		return &Soft80::op_NEG<D, S>;
+	}
+	else if constexpr (N == Names::NOP) {
+		return &Soft80::op_NOP<D, S>;
+	}
+	else if constexpr (N == Names::OR) {
+		return &Soft80::op_OR<D, S>;
+	}
+	else if constexpr (N == Names::OTDR) {
+		return &Soft80::op_OTDR<D, S>;
+	}
+	else if constexpr (N == Names::OTIR) {
+		return &Soft80::op_OTIR<D, S>;
+	}
+	else if constexpr (N == Names::OUT) {
+		return &Soft80::op_OUT<D, S>;
+	}
+	else if constexpr (N == Names::OUTD) {
+		return &Soft80::op_OUTD<D, S>;
+	}
+	else if constexpr (N == Names::OUTI) {
+		return &Soft80::op_OUTI<D, S>;
+	}
+	else if constexpr (N == Names::POP) {
+		return &Soft80::op_POP<D, S>;
+	}
+	else if constexpr (N == Names::PUSH) {
+		return &Soft80::op_PUSH<D, S>;
+	}
+	else if constexpr (N == Names::RES) {
+		return &Soft80::op_RES<D, S>;
+	}
+	else if constexpr (N == Names::RET) {
+		return &Soft80::op_RET<D, S>;
+	}
+	else if constexpr (N == Names::RETI) {
+		return &Soft80::op_RETI<D, S>;
+	}
+	else if constexpr (N == Names::RETN) {
+		return &Soft80::op_RETN<D, S>;
+	}
+	else if constexpr (N == Names::RL) {
+		return &Soft80::op_RL<D, S>;
+	}
+	else if constexpr (N == Names::RLA) {
+		return &Soft80::op_RLA<D, S>;
+	}
+	else if constexpr (N == Names::RLC) {
+		return &Soft80::op_RLC<D, S>;
+	}
+	else if constexpr (N == Names::RLCA) {
+		return &Soft80::op_RLCA<D, S>;
+	}
+	else if constexpr (N == Names::RLD) {
+		return &Soft80::op_RLD<D, S>;
+	}
+	else if constexpr (N == Names::RR) {
+		return &Soft80::op_RR<D, S>;
+	}
+	else if constexpr (N == Names::RRA) {
+		return &Soft80::op_RRA<D, S>;
+	}
+	else if constexpr (N == Names::RRC) {
+		return &Soft80::op_RRC<D, S>;
+	}
+	else if constexpr (N == Names::RRCA) {
+		return &Soft80::op_RRCA<D, S>;
+	}
+	else if constexpr (N == Names::RRD) {
+		return &Soft80::op_RRD<D, S>;
+	}
+	else if constexpr (N == Names::RST) {
+		return &Soft80::op_RST<D, S>;
+	}
+	else if constexpr (N == Names::SBC) {
+		return &Soft80::op_SBC<D, S>;
+	}
+	else if constexpr (N == Names::SCF) {
+		return &Soft80::op_SCF<D, S>;
+	}
+	else if constexpr (N == Names::SET) {
+		return &Soft80::op_SET<D, S>;
+	}
+	else if constexpr (N == Names::SLA) {
+		return &Soft80::op_SLA<D, S>;
+	}
+	else if constexpr (N == Names::SRA) {
+		return &Soft80::op_SRA<D, S>;
+	}
+	else if constexpr (N == Names::SLL) {
+		return &Soft80::op_SLL<D, S>;
+	}
+	else if constexpr (N == Names::SRL) {
+		return &Soft80::op_SRL<D, S>;
+	}
+	else if constexpr (N == Names::SUB) {
+		return &Soft80::op_SUB<D, S>;
+	}
+	else if constexpr (N == Names::XOR) {
+		return &Soft80::op_XOR<D, S>;
+	}
+	else if constexpr (N == Names::NONI) {
+		return &Soft80::op_NONI<D, S>;
+	}
+	else if constexpr (N == Names::RLCalt) {
+		return &Soft80::op_RLCalt<D, S>;
+	}
+	else if constexpr (N == Names::RRCalt) {
+		return &Soft80::op_RRCalt<D, S>;
+	}
+	else if constexpr (N == Names::RLalt) {
+		return &Soft80::op_RLalt<D, S>;
+	}
+	else if constexpr (N == Names::RRalt) {
+		return &Soft80::op_RRalt<D, S>;
+	}
+	else if constexpr (N == Names::SLAalt) {
+		return &Soft80::op_SLAalt<D, S>;
+	}
+	else if constexpr (N == Names::SRAalt) {
+		return &Soft80::op_SRAalt<D, S>;
+	}
+	else if constexpr (N == Names::SLLalt) {
+		return &Soft80::op_SLLalt<D, S>;
+	}
+	else if constexpr (N == Names::SRLalt) {
+		return &Soft80::op_SRLalt<D, S>;
+	}
+	else if constexpr (N == Names::RESalt) {
+		return &Soft80::op_RESalt<D, S>;
+	}
+	else if constexpr (N == Names::SETalt) {
+		return &Soft80::op_SETalt<D, S>;
+	}
+}
+
+template <size_t... I>
+constexpr std::array<Soft80::Handler, sizeof...(I)> Soft80::make_handlers(std::index_sequence<I...>) {
+	return { handler_for<handler_keys[I].name, handler_keys[I].dest, handler_keys[I].source>()... };
+}
+
+uint8_t Soft80::bind_handler(const Instruction& instruction) {
+	static_assert(HandlerCount <= 256);
+
+	return handler_index[key_index(instruction)];
+}
+
+void Soft80::execute_instruction() {
+	static constexpr std::array<Handler, HandlerCount> handlers = make_handlers(std::make_index_sequence<HandlerCount>{});
+
+	branch_taken = false;
+	block_repeats = false;
+
+	(this->*handlers[current_handler])(current_instruction.value());
+
+	current_instruction = std::nullopt;
+
+	if (accuracy == Accuracy::InstructionCycle) {
+		size_t t_cycles = block_repeats ? current_timing.repeat
+			: branch_taken ? current_timing.taken
+			: current_timing.base;
+
+		// The vector byte took one T-state instead of a four T-state fetch.
+		if (vector_fetch) {
+			t_cycles -= 3;
+			vector_fetch = false;
+		}
+
+		charge_t_cycles(t_cycles);
+	}
+	else if (accuracy == Accuracy::Functional) {
+		vector_fetch = false;
+
+		charge_t_cycles(current_timing.base);
+	}
+
+	if (pair_counts) {
+		(*pair_counts)[previous_handler << 8 | current_handler]++;
+		previous_handler = current_handler;
+	}
+}
+
+void Soft80::set_pair_profiling(bool enabled) {
+	if (!enabled) {
+		pair_counts.reset();
+	}
+	else if (!pair_counts) {
+		pair_counts = std::make_unique<PairCounts>();
+		previous_handler = handler_index[key_index(Instruction::Names::NOP, OperandKind::None, OperandKind::None)];
+	}
+}
+
+std::vector<Soft80::PairCount> Soft80::pair_histogram() const {
+	std::vector<PairCount> ret;
+
+	if (!pair_counts) {
+		return ret;
+	}
+
+	for (size_t i = 0; i < pair_counts->size(); i++) {
+		if ((*pair_counts)[i] != 0) {
+			const HandlerKey& first = handler_keys[i >> 8];
+			const HandlerKey& second = handler_keys[i & 0xFF];
+
+			ret.push_back({
+				first.name, first.dest, first.source,
+				second.name, second.dest, second.source,
+				(*pair_counts)[i] });
+		}
+	}
+
+	std::stable_sort(ret.begin(), ret.end(), [](const PairCount& a, const PairCount& b) {
+		return a.count > b.count;
+	});
+
+	return ret;
+}
+
+// One more than the superinstruction for the two handlers, or zero.
+uint8_t Soft80::bind_fused(uint8_t first, uint8_t second) {
+	for (size_t i = 0; i < fused_keys.size(); i++) {
+		if (first == handler_index[key_index(fused_keys[i].first)]
+			&& second == handler_index[key_index(fused_keys[i].second)]) {
+			return static_cast<uint8_t>(i + 1);
+		}
+	}
+
+	return 0;
+}
+
+void Soft80::execute_fused(const CachedInstruction* entries, const BasicBlock& block) {
+	static constexpr std::array<FusedHandler, fused_keys.size()> fused = {
+		&Soft80::fused_NOP_NOP,
+		&Soft80::fused_DEC_JP,
+		&Soft80::fused_LD_DEC,
+		&Soft80::fused_DEC_JR,
+		&Soft80::fused_LD_INC,
+		&Soft80::fused_LD_OUT,
+		&Soft80::fused_PUSH_PUSH,
+		&Soft80::fused_POP_POP
+	};
+
+	branch_taken = false;
+	block_repeats = false;
+
+	(this->*fused[entries[0].fused - 1])(entries, block);
+}
+
+// What load_cached() does for an entry in a block, where the fetch cycles
+// only step PC.
+void Soft80::enter_fused(const CachedInstruction& entry) {
+	if (!history_ring.empty()) {
+		record_history(registers.PC, entry.length, entry.bytes, total_t_cycles);
+	}
+
+	registers.PC = registers.PC + entry.length;
+}
+
+// What execute_instruction() does once the handler has run.
+void Soft80::retire_fused(const CachedInstruction& entry, bool taken) {
+	if (accuracy == Accuracy::InstructionCycle && taken) {
+		charge_t_cycles(entry.timing.taken);
+	}
+	else {
+		charge_t_cycles(entry.timing.base);
+	}
+
+	current_handler = entry.handler;
+	current_timing = entry.timing;
+
+	if (pair_counts) {
+		(*pair_counts)[previous_handler << 8 | entry.handler]++;
+		previous_handler = entry.handler;
+	}
+}
+
+// Block instructions go round again by fetching themselves anew.
+void Soft80::repeat_instruction() {
+	registers.PC = registers.PC - 2;
+
+	block_repeats = true;
+}
+
+template <OperandKind D, OperandKind S>
+Soft80::Operands Soft80::fetch_operands(const Instruction& instruction) {
+	Operands ret;
+
+	if constexpr (is_register(D) || is_register(S)) {
+		if (is_flag_register(instruction.dest) || is_flag_register(instruction.source)) {
+			materialize_flags();
+		}
+	}
+
+	if constexpr (D == OperandKind::Immediate || D == OperandKind::Absolute) {
+		ret.dest_value = instruction.imm;
+	}
+	else if constexpr (is_register(D)) {
+		ret.dest_value = registers.read<D == OperandKind::Pair>(instruction.dest);
+	}
+	else if constexpr (D != OperandKind::None) {
+		ret.dest_value = registers.get_value(instruction.dest).value_or(0);
+	}
+
+	if constexpr (S == OperandKind::Immediate || S == OperandKind::Absolute) {
+		ret.source_value = instruction.imm;
+	}
+	else if constexpr (is_register(S)) {
+		ret.source_value = registers.read<S == OperandKind::Pair>(instruction.source);
+	}
+	else if constexpr (S != OperandKind::None) {
+		ret.source_value = registers.get_value(instruction.source).value_or(0);
+	}
+
+	if constexpr (is_memory(D)) {
+		ret.operand1 = read_memory(ret.dest_value + instruction.displacement);
+	}
+	else {
+		ret.operand1 = ret.dest_value;
+	}
+
+	if constexpr (is_memory(S)) {
+		ret.operand2 = read_memory(ret.source_value + instruction.displacement);
+	}
+	else {
+		ret.operand2 = ret.source_value;
+	}
+
+	return ret;
+}
+
+template <OperandKind D>
+void Soft80::write_result(const Instruction& instruction, uint16_t dest_value, uint32_t result) {
+	if constexpr (is_memory(D)) {
+		write_memory(dest_value, result);
+	}
+	else if constexpr (is_register(D)) {
+		registers.write<D == OperandKind::Pair>(instruction.dest, result);
+	}
+}
+
+bool Soft80::condition_met(Instruction::Conditions condition) {
+	Flags flags = parse_flags(materialize_flags());
+
+	bool met = true;
+
+	switch (condition) {
+	case Instruction::Conditions::NZ:
+		met = !flags.zero;
+		break;
+	case Instruction::Conditions::Z:
+		met = flags.zero;
+		break;
+	case Instruction::Conditions::NC:
+		met = !flags.carry;
+		break;
+	case Instruction::Conditions::C:
+		met = flags.carry;
+		break;
+	case Instruction::Conditions::PO:
+		met = !flags.parity;
+		break;
+	case Instruction::Conditions::PE:
+		met = flags.parity;
+		break;
+	case Instruction::Conditions::P:
+		met = !flags.sign;
+		break;
+	case Instruction::Conditions::M:
+		met = flags.sign;
+		break;
+	default:
+		break;
+	}
+
+	branch_taken = met;
+
+	return met;
+}
+
+void Soft80::set_flags(uint8_t value) {
+	registers.main.F = value;
+
+	lazy_flags.kind = LazyFlags::Kind::None;
+}
+
+void Soft80::defer_flags(LazyFlags::Kind kind, uint32_t result, uint32_t operand1, uint32_t operand2, bool wide, uint8_t fixed) {
+	lazy_flags.kind = kind;
+	lazy_flags.wide = wide;
+	lazy_flags.fixed = fixed;
+	lazy_flags.result = result;
+	lazy_flags.operand1 = operand1;
+	lazy_flags.operand2 = operand2;
+}
+
+uint8_t Soft80::materialize_flags() {
+	const LazyFlags& l = lazy_flags;
+
+	switch (l.kind) {
+	case LazyFlags::Kind::None:
+		return registers.main.F;
+	case LazyFlags::Kind::Arithmetic:
+		if (in_arithmetic_table(l.result, l.wide)) {
+			registers.main.F = FlagTables::arithmetic[l.result & 0x1FF] | half_carry(l.operand1, l.operand2) | l.fixed;
+		}
+		else {
+			registers.main.F = arithmetic(l.result, l.operand1, l.operand2, l.wide) | carry(l.result, l.wide) | l.fixed;
+		}
+		break;
+	case LazyFlags::Kind::IncDec:
+		if (in_arithmetic_table(l.result, l.wide)) {
+			registers.main.F = (FlagTables::arithmetic[l.result & 0x1FF] & ~FlagBits::Carry) | half_carry(l.operand1, l.operand2) | l.fixed;
+		}
+		else {
+			registers.main.F = arithmetic(l.result, l.operand1, l.operand2, l.wide) | l.fixed;
+		}
+		break;
+	case LazyFlags::Kind::Parity:
+		registers.main.F = szp(l.result, l.wide) | l.fixed;
+		break;
+	case LazyFlags::Kind::Undocumented:
+		registers.main.F = undocumented(l.result) | l.fixed;
+		break;
+	}
+
+	lazy_flags.kind = LazyFlags::Kind::None;
+
+	return registers.main.F;
+}
+
+void Soft80::push_word(uint16_t value) {
+	registers.SP--;
+	write_memory(registers.SP, (value & 0xFF00) >> 8);
+	registers.SP--;
+	write_memory(registers.SP, value & 0x00FF);
+}
+
+uint16_t Soft80::pop_word() {
+	uint16_t low = read_memory(registers.SP);
+	registers.SP++;
+	uint16_t high = read_memory(registers.SP);
+	registers.SP++;
+
+	return low | (high << 8);
+}
+
+// Shared by the instructions that only move or test data: F is cleared and
+// the (unchanged) result is still written back to the destination.
+template <OperandKind D>
+void Soft80::finish(const Instruction& instruction, const Operands& operands, uint32_t result) {
+	set_flags(0);
+
+	write_result<D>(instruction, operands.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_ADC(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = o.operand1 + o.operand2;
+
+	if (materialize_flags() & FlagBits::Carry) {
+		result += 1;
+	}
+
+	defer_flags(LazyFlags::Kind::Arithmetic, result, o.operand1, o.operand2, wide, 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_ADD(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = o.operand1 + o.operand2;
+
+	defer_flags(LazyFlags::Kind::Arithmetic, result, o.operand1, o.operand2, wide, 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_AND(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t result = o.operand1 & o.operand2;
+
+	defer_flags(LazyFlags::Kind::Parity, result, o.operand1, o.operand2, is_wide(D, S), FlagBits::HalfCarry);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_BIT(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t bit = 1 << o.operand1;
+
+	uint8_t flags = FlagBits::HalfCarry;
+
+	if (bit & o.operand2) {
+		if (o.operand1 == 7) {
+			flags |= FlagBits::Sign;
+		}
+	}
+	else {
+		flags |= FlagBits::Zero | FlagBits::Overflow;
+	}
+
+	set_flags(flags);
+
+	write_result<D>(instruction, o.dest_value, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CALL(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	if (condition_met(instruction.condition)) {
+		push_word(registers.PC);
+
+		registers.PC = o.dest_value;
+	}
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CCF(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	set_flags((materialize_flags() & FlagBits::Carry) ? FlagBits::HalfCarry : FlagBits::Carry);
+
+	write_result<D>(instruction, o.dest_value, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CP(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = o.operand2;
+
+	defer_flags(LazyFlags::Kind::Arithmetic, result, o.operand1, o.operand2, wide, FlagBits::Subtract);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+// Compares A with (HL), steps HL by delta, and returns whether another
+// iteration is due.
+static uint8_t block_compare_flags(uint8_t A, uint8_t val, uint16_t BC) {
+	uint8_t res = A - val;
+
+	uint8_t flags = FlagBits::Subtract;
+
+	if (res & 0x80) {
+		flags |= FlagBits::Sign;
+	}
+
+	if (res == 0) {
+		flags |= FlagBits::Zero;
+	}
+
+	if ((A & 0x10) && (val & 0x10)) {
+		flags |= FlagBits::HalfCarry;
+	}
+
+	if (BC != 0) {
+		flags |= FlagBits::Overflow;
+	}
+
+	return flags;
+}
+
+template <OperandKind D, OperandKind S>
+bool Soft80::block_compare(const Instruction& instruction, int delta) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint16_t HL = registers.main.HL;
+	uint16_t BC = registers.main.BC;
+	uint8_t A = registers.main.A;
+
+	uint8_t val = read_memory(HL);
+
+	uint8_t res = A - val;
+
+	registers.main.HL = HL + delta;
+	registers.main.BC = BC - 1;
+
+	set_flags(block_compare_flags(A, val, registers.main.BC));
+
+	write_result<D>(instruction, o.dest_value, 0);
+
+	return res != 0 && registers.main.BC != 0;
+}
+
+// Runs further iterations of a CPIR or CPDR as a host search, as many as
+// bulk_iterations() allows and plain memory holds. Returns whether the
+// instruction still goes round again.
+bool Soft80::bulk_block_compare(int delta, uint8_t opcode) {
+	size_t count = bulk_iterations(registers.main.BC, opcode);
+
+	if (count == 0) {
+		return true;
+	}
+
+	uint16_t HL = registers.main.HL;
+	uint8_t A = registers.main.A;
+
+	const uint8_t* source = memory.direct_run(HL, delta, count, false);
+
+	if (!source) {
+		return true;
+	}
+
+	size_t searched = count;
+
+	if (delta > 0) {
+		const void* match = memchr(source, A, count);
+
+		if (match) {
+			searched = static_cast<const uint8_t*>(match) - source + 1;
+		}
+	}
+	else {
+		auto first = std::make_reverse_iterator(source + 1);
+		auto match = std::find(first, first + count, A);
+
+		if (match != first + count) {
+			searched = match - first + 1;
+		}
+	}
+
+	uint8_t val = source[delta * (static_cast<int>(searched) - 1)];
+
+	registers.main.HL = HL + delta * static_cast<int>(searched);
+	registers.main.BC = registers.main.BC - searched;
+
+	set_flags(block_compare_flags(A, val, registers.main.BC));
+
+	// The bus is left as the last read would leave it.
+	if (accuracy == Accuracy::BusCycle) {
+		address_bus = registers.main.HL - delta;
+	}
+
+	bool repeats = val != A && registers.main.BC != 0;
+
+	charge_bulk_iterations(searched, !repeats);
+
+	return repeats;
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CPD(const Instruction& instruction) {
+	block_compare<D, S>(instruction, -1);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CPDR(const Instruction& instruction) {
+	if (block_compare<D, S>(instruction, -1) && bulk_block_compare(-1, 0xB9)) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CPI(const Instruction& instruction) {
+	block_compare<D, S>(instruction, 1);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CPIR(const Instruction& instruction) {
+	if (block_compare<D, S>(instruction, 1) && bulk_block_compare(1, 0xB1)) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_CPL(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	set_flags(FlagBits::HalfCarry | FlagBits::Subtract);
+
+	write_result<D>(instruction, o.dest_value, ~o.operand1);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_DAA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	Flags flags = parse_flags(materialize_flags());
+
+	const FlagTables::Adjustment& adjustment = FlagTables::daa[FlagTables::daa_index(o.operand1, flags.half_carry, flags.carry)];
+
+	set_flags(adjustment.flags | half_carry(o.operand1, o.operand2));
+
+	write_result<D>(instruction, o.dest_value, adjustment.result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_DEC(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t result = o.operand1 - 1;
+
+	defer_flags(LazyFlags::Kind::IncDec, result, o.operand1, o.operand2, is_wide(D, S), FlagBits::Subtract);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_DI(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	iff1 = false;
+	iff2 = false;
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_DJNZ(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	registers.main.B = registers.main.B - 1;
+
+	branch_taken = registers.main.B != 0;
+
+	if (branch_taken) {
+		registers.PC = registers.PC + instruction.displacement;
+	}
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_EI(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	iff1 = true;
+	iff2 = true;
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_EX(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	if constexpr (is_register(S)) {
+		registers.write<S == OperandKind::Pair>(instruction.source, o.operand1);
+	}
+	else {
+		registers.set_value(instruction.source, o.operand1);
+	}
+
+	finish<D>(instruction, o, o.operand2);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_EXX(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	registers.exchange_banks();
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_HALT(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	set_pins(PinBits::HALT, true);
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_IM(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	if (instruction.imm == 0) {
+		interrupt_mode = 0;
+	}
+	else if (instruction.imm == 2) {
+		interrupt_mode = 1;
+	}
+	else if (instruction.imm == 3) {
+		interrupt_mode = 2;
+	}
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_IN(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint8_t low = registers.main.C;
+	uint8_t high = registers.main.B;
+
+	if (instruction.source == RegisterFile::Names::Immediate) {
+		low = instruction.imm_low;
+		high = registers.main.A;
+	}
+
+	uint32_t result = read_io(low, high);
+
+	defer_flags(LazyFlags::Kind::Parity, result, o.operand1, o.operand2, is_wide(D, S), 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_INC(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t result = o.operand1 + 1;
+
+	defer_flags(LazyFlags::Kind::IncDec, result, o.operand1, o.operand2, is_wide(D, S), 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+// One INI/IND step; the result is never written back. Returns B afterwards.
+template <OperandKind D, OperandKind S>
+uint8_t Soft80::block_input(const Instruction& instruction, int delta) {
+	fetch_operands<D, S>(instruction);
+
+	uint8_t C = registers.main.C;
+	uint8_t B = registers.main.B;
+	uint16_t HL = registers.main.HL;
+
+	uint8_t val = read_io(C, B);
+
+	write_memory(HL, val);
+
+	registers.main.B = B - 1;
+	registers.main.HL = HL + delta;
+
+	return registers.main.B;
+}
+
+// Hands further iterations of an INIR, INDR, OTIR or OTDR to the device in
+// one call, if it takes blocks and bulk_iterations() allows. The guest
+// memory is passed as is going up and through a buffer going down. Returns
+// B afterwards.
+uint8_t Soft80::bulk_block_io(int delta, uint8_t opcode, bool input) {
+	uint8_t B = registers.main.B;
+	uint8_t C = registers.main.C;
+
+	size_t count = bulk_iterations(B, opcode);
+
+	if (count == 0 || !devices.takes_blocks(C)) {
+		return B;
+	}
+
+	uint16_t HL = registers.main.HL;
+
+	uint8_t* run = memory.direct_run(HL, delta, count, input);
+
+	if (!run) {
+		return B;
+	}
+
+	uint16_t low = delta > 0 ? HL : HL - (count - 1);
+	uint16_t high = low + (count - 1);
+
+	if (input && overwrites_instruction(low, high)) {
+		return B;
+	}
+
+	std::array<uint8_t, 256> buffer;
+
+	uint8_t* first = delta > 0 ? run : run - (count - 1);
+	auto reversed = std::make_reverse_iterator(run + 1);
+
+	std::span<uint8_t> data = delta > 0 ? std::span<uint8_t>(first, count) : std::span<uint8_t>(buffer.data(), count);
+
+	if (input) {
+		devices.read_block(C, B, data);
+
+		if (delta < 0) {
+			std::copy(data.begin(), data.end(), reversed);
+		}
+
+		memory.notify_write(low, high);
+	}
+	else {
+		if (delta < 0) {
+			std::copy(reversed, reversed + count, data.begin());
+		}
+
+		devices.write_block(C, B, data);
+	}
+
+	registers.main.B = B - count;
+	registers.main.HL = HL + delta * static_cast<int>(count);
+
+	// The bus is left as the last transfer would leave it.
+	if (accuracy == Accuracy::BusCycle) {
+		if (input) {
+			address_bus = registers.main.HL - delta;
+		}
+		else {
+			address_bus = (static_cast<uint16_t>(registers.main.B + 1) << 8) | C;
+		}
+
+		data_bus = data[count - 1];
+	}
+
+	charge_bulk_iterations(count, registers.main.B == 0);
+
+	return registers.main.B;
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_IND(const Instruction& instruction) {
+	uint8_t B = block_input<D, S>(instruction, -1);
+
+	set_flags(FlagBits::Subtract | zero(B));
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_INDR(const Instruction& instruction) {
+	uint8_t B = block_input<D, S>(instruction, -1);
+
+	set_flags(FlagBits::Zero | FlagBits::Subtract);
+
+	if (B != 0 && bulk_block_io(-1, 0xBA, true) != 0) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_INI(const Instruction& instruction) {
+	uint8_t B = block_input<D, S>(instruction, 1);
+
+	set_flags(FlagBits::Subtract | zero(B));
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_INIR(const Instruction& instruction) {
+	uint8_t B = block_input<D, S>(instruction, 1);
+
+	set_flags(FlagBits::Zero | FlagBits::Subtract);
+
+	if (B != 0 && bulk_block_io(1, 0xB2, true) != 0) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_JP(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	if (condition_met(instruction.condition)) {
+		registers.PC = o.dest_value;
+	}
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_JR(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	registers.PC = registers.PC + instruction.displacement;
+
+	branch_taken = true;
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_LD(const Instruction& instruction) {
+	// Loads into a register need no operand resolution.
+	if constexpr (is_register(D) && S == OperandKind::Immediate) {
+		set_flags(0);
+
+		registers.write<D == OperandKind::Pair>(instruction.dest, instruction.imm);
+	}
+	else if constexpr (is_register(D) && is_register(S)) {
+		uint16_t value = registers.read<S == OperandKind::Pair>(instruction.source);
+
+		if (instruction.dest == RegisterFile::Names::A
+			&& (instruction.source == RegisterFile::Names::I
+				|| instruction.source == RegisterFile::Names::R)) {
+
+			uint8_t flags = szp(value, false) & ~FlagBits::Overflow;
+
+			if (iff2) {
+				flags |= FlagBits::Overflow;
+			}
+
+			set_flags(flags);
+		}
+		else {
+			set_flags(0);
+		}
+
+		registers.write<D == OperandKind::Pair>(instruction.dest, value);
+	}
+	else {
+		Operands o = fetch_operands<D, S>(instruction);
+
+		finish<D>(instruction, o, o.operand2);
+	}
+}
+
+// One LDI/LDD step. The repeating forms always leave P/V clear. Returns BC
+// afterwards.
+template <OperandKind D, OperandKind S>
+uint16_t Soft80::block_load(const Instruction& instruction, int delta, bool repeat) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint16_t DE = registers.main.DE;
+	uint16_t HL = registers.main.HL;
+	uint16_t BC = registers.main.BC;
+
+	uint8_t val = read_memory(HL);
+	write_memory(DE, val);
+
+	registers.main.DE = DE + delta;
+	registers.main.HL = HL + delta;
+	registers.main.BC = BC - 1;
+
+	set_flags((!repeat && registers.main.BC != 0) ? FlagBits::Overflow : 0);
+
+	write_result<D>(instruction, o.dest_value, 0);
+
+	return registers.main.BC;
+}
+
+// Copies the way the byte loop of LDIR (delta 1) or LDDR (delta -1) does,
+// with dest and source at the lowest byte of each range. Where the
+// destination runs into source bytes not yet read, the loop repeats the
+// bytes it has already copied, so copy one gap's worth at a time.
+static void block_copy(uint8_t* dest, const uint8_t* source, size_t count, int delta) {
+	uintptr_t d = reinterpret_cast<uintptr_t>(dest);
+	uintptr_t s = reinterpret_cast<uintptr_t>(source);
+
+	if (delta > 0 && d > s && d - s < count) {
+		for (size_t done = 0; done < count; done += d - s) {
+			memcpy(dest + done, source + done, std::min<size_t>(d - s, count - done));
+		}
+	}
+	else if (delta < 0 && s > d && s - d < count) {
+		for (size_t done = 0; done < count; done += s - d) {
+			size_t chunk = std::min<size_t>(s - d, count - done);
+
+			memcpy(dest + count - done - chunk, source + count - done - chunk, chunk);
+		}
+	}
+	else {
+		memmove(dest, source, count);
+	}
+}
+
+// Runs further iterations of an LDIR or LDDR as a host copy, as many as
+// bulk_iterations() allows and plain memory holds. Returns BC afterwards.
+uint16_t Soft80::bulk_block_load(int delta, uint8_t opcode) {
+	size_t count = bulk_iterations(registers.main.BC, opcode);
+
+	if (count == 0) {
+		return registers.main.BC;
+	}
+
+	uint16_t HL = registers.main.HL;
+	uint16_t DE = registers.main.DE;
+
+	uint8_t* source = memory.direct_run(HL, delta, count, false);
+	uint8_t* dest = source ? memory.direct_run(DE, delta, count, true) : nullptr;
+
+	if (!dest) {
+		return registers.main.BC;
+	}
+
+	uint16_t low = delta > 0 ? DE : DE - (count - 1);
+	uint16_t high = low + (count - 1);
+	if (overwrites_instruction(low, high)) {
+		return registers.main.BC;
+	}
+
+	if (delta > 0) {
+		block_copy(dest, source, count, delta);
+	}
+	else {
+		block_copy(dest - (count - 1), source - (count - 1), count, delta);
+	}
+
+	memory.notify_write(low, high);
+
+	registers.main.HL = HL + delta * static_cast<int>(count);
+	registers.main.DE = DE + delta * static_cast<int>(count);
+	registers.main.BC = registers.main.BC - count;
+
+	// The bus is left as the last write would leave it.
+	if (accuracy == Accuracy::BusCycle) {
+		address_bus = registers.main.DE - delta;
+		data_bus = dest[delta * (static_cast<int>(count) - 1)];
+	}
+
+	charge_bulk_iterations(count, registers.main.BC == 0);
+
+	return registers.main.BC;
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_LDD(const Instruction& instruction) {
+	block_load<D, S>(instruction, -1, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_LDDR(const Instruction& instruction) {
+	if (block_load<D, S>(instruction, -1, true) != 0 && bulk_block_load(-1, 0xB8) != 0) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_LDI(const Instruction& instruction) {
+	block_load<D, S>(instruction, 1, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_LDIR(const Instruction& instruction) {
+	if (block_load<D, S>(instruction, 1, true) != 0 && bulk_block_load(1, 0xB0) != 0) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_NEG(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = -o.operand1;
+
+	defer_flags(LazyFlags::Kind::Arithmetic, result, o.operand1, o.operand2, wide, FlagBits::Subtract);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_NOP(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_OR(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t result = o.operand1 | o.operand2;
+
+	defer_flags(LazyFlags::Kind::Parity, result, o.operand1, o.operand2, is_wide(D, S), 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+// One OUTI/OUTD step; the result is never written back. Returns B afterwards.
+template <OperandKind D, OperandKind S>
+uint8_t Soft80::block_output(const Instruction& instruction, int delta) {
+	fetch_operands<D, S>(instruction);
+
+	uint8_t C = registers.main.C;
+	uint8_t B = registers.main.B;
+	uint16_t HL = registers.main.HL;
+
+	uint8_t val = read_memory(HL);
+
+	write_io(C, B, val);
+
+	registers.main.B = B - 1;
+	registers.main.HL = HL + delta;
+
+	return registers.main.B;
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_OTDR(const Instruction& instruction) {
+	uint8_t B = block_output<D, S>(instruction, -1);
+
+	set_flags(FlagBits::Zero | FlagBits::Subtract);
+
+	if (B != 0 && bulk_block_io(-1, 0xBB, false) != 0) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_OTIR(const Instruction& instruction) {
+	uint8_t B = block_output<D, S>(instruction, 1);
+
+	set_flags(FlagBits::Zero | FlagBits::Subtract);
+
+	if (B != 0 && bulk_block_io(1, 0xB3, false) != 0) {
+		repeat_instruction();
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_OUT(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint8_t low = registers.main.C;
+	uint8_t high = registers.main.B;
+
+	if (instruction.dest == RegisterFile::Names::Immediate) {
+		low = instruction.imm_low;
+		high = registers.main.A;
+	}
+
+	write_io(low, high, o.operand2);
+
+	set_flags(0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_OUTD(const Instruction& instruction) {
+	uint8_t B = block_output<D, S>(instruction, -1);
+
+	set_flags(FlagBits::Subtract | zero(B));
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_OUTI(const Instruction& instruction) {
+	uint8_t B = block_output<D, S>(instruction, 1);
+
+	set_flags(FlagBits::Subtract | zero(B));
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_POP(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t result = pop_word();
+
+	finish<D>(instruction, o, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_PUSH(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	push_word(o.operand2);
+
+	finish<D>(instruction, o, 0);
+}
+
+// Stores the updated bit of RES/SET back into the source operand.
+template <OperandKind S>
+void Soft80::write_source(const Instruction& instruction, const Operands& operands, uint8_t value) {
+	if constexpr (is_memory(S)) {
+		write_memory(operands.source_value, value);
+	}
+	else if constexpr (is_register(S)) {
+		registers.write<S == OperandKind::Pair>(instruction.source, value);
+	}
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RES(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint8_t bit = 1 << o.operand1;
+
+	write_source<S>(instruction, o, (o.operand2 | bit) ^ bit);
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RET(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	if (condition_met(instruction.condition)) {
+		registers.PC = pop_word();
+	}
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RETI(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	registers.PC = pop_word();
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RETN(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	registers.PC = pop_word();
+
+	iff1 = iff2;
+
+	finish<D>(instruction, o, 0);
+}
+
+// The rotates and shifts below take their value from operand1, or from
+// operand2 in the DDCB/FDCB forms that also copy into a register.
+
+template <OperandKind D, OperandKind S>
+void Soft80::rotate_left(const Instruction& instruction, const Operands& o, uint32_t value, bool carry_in, bool accumulator) {
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = value << 1;
+
+	if (carry_in) {
+		result |= 1;
+	}
+
+	LazyFlags::Kind kind = accumulator ? LazyFlags::Kind::Undocumented : LazyFlags::Kind::Parity;
+
+	defer_flags(kind, result, o.operand1, o.operand2, wide, carry(result, wide));
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::rotate_right(const Instruction& instruction, const Operands& o, uint32_t value, uint32_t high_bits, bool accumulator) {
+	uint32_t result = (value >> 1) | high_bits;
+
+	LazyFlags::Kind kind = accumulator ? LazyFlags::Kind::Undocumented : LazyFlags::Kind::Parity;
+
+	defer_flags(kind, result, o.operand1, o.operand2, is_wide(D, S), (value & 1) ? FlagBits::Carry : 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RL(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand1, materialize_flags() & FlagBits::Carry, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RLA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand1, false, true);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RLC(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand1, o.operand1 & 0xFFFFFF00, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RLCA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand1, o.operand1 & 0xFFFFFF00, true);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RLD(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint16_t A = 0x000F & registers.main.A;
+	uint16_t HL = read_memory(registers.main.HL);
+
+	uint32_t result = static_cast<uint32_t>((A << 8) | HL) << 4;
+
+	defer_flags(LazyFlags::Kind::Parity, result, o.operand1, o.operand2, is_wide(D, S), 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RR(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand1, 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RRA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand1, 0, true);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RRC(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand1, (o.operand1 & 1) ? 0x80 : 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RRCA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand1, (o.operand1 & 1) ? 0x80 : 0, true);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RRD(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint16_t A = 0x000F & registers.main.A;
+	uint16_t HL = read_memory(registers.main.HL);
+
+	uint32_t result = static_cast<uint32_t>((A << 8) | HL) >> 4;
+
+	defer_flags(LazyFlags::Kind::Parity, result, o.operand1, o.operand2, is_wide(D, S), 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RST(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	push_word(registers.PC);
+
+	registers.PC = instruction.imm;
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SBC(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = o.operand1 - o.operand2;
+
+	if (materialize_flags() & FlagBits::Carry) {
+		result -= 1;
+	}
+
+	defer_flags(LazyFlags::Kind::Arithmetic, result, o.operand1, o.operand2, wide, FlagBits::Subtract);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SCF(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	set_flags(FlagBits::Carry);
+
+	write_result<D>(instruction, o.dest_value, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SET(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint8_t bit = 1 << o.operand1;
+
+	write_source<S>(instruction, o, o.operand2 | bit);
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SLA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand1, false, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SRA(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t value = (o.operand1 & 0xFFFFFF80) ? (o.operand1 | 0xFFFFFF00) : o.operand1;
+
+	rotate_right<D, S>(instruction, o, value, 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SLL(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand1, true, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SRL(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand1, 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SUB(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+	constexpr bool wide = is_wide(D, S);
+
+	uint32_t result = o.operand1 - o.operand2;
+
+	defer_flags(LazyFlags::Kind::Arithmetic, result, o.operand1, o.operand2, wide, FlagBits::Subtract);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_XOR(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t result = o.operand1 ^ o.operand2;
+
+	defer_flags(LazyFlags::Kind::Parity, result, o.operand1, o.operand2, is_wide(D, S), 0);
+
+	write_result<D>(instruction, o.dest_value, result);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_NONI(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RLCalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand2, o.operand2 & 0xFFFFFF00, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RRCalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand2, (o.operand2 & 1) ? 0x80 : 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RLalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand2, materialize_flags() & FlagBits::Carry, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RRalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand2, 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SLAalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand2, false, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SRAalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint32_t value = (o.operand2 & 0xFFFFFF80) ? (o.operand2 | 0xFFFFFF00) : o.operand2;
+
+	rotate_right<D, S>(instruction, o, value, 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SLLalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_left<D, S>(instruction, o, o.operand2, true, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SRLalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	rotate_right<D, S>(instruction, o, o.operand2, 0, false);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_RESalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint8_t bit = 1 << instruction.imm;
+
+	write_source<S>(instruction, o, (o.operand2 | bit) ^ bit);
+
+	finish<D>(instruction, o, 0);
+}
+
+template <OperandKind D, OperandKind S>
+void Soft80::op_SETalt(const Instruction& instruction) {
+	Operands o = fetch_operands<D, S>(instruction);
+
+	uint8_t bit = 1 << instruction.imm;
+
+	write_source<S>(instruction, o, o.operand2 | bit);
+
+	finish<D>(instruction, o, 0);
+}
+
+void Soft80::fused_NOP_NOP(const CachedInstruction* entries, const BasicBlock&) {
+	enter_fused(entries[0]);
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+	set_flags(0);
+	retire_fused(entries[1], false);
+}
+
+// JP clears F once it has tested it, so DEC only has to leave the flags
+// its condition reads.
+void Soft80::fused_DEC_JP(const CachedInstruction* entries, const BasicBlock&) {
+	const Instruction& dec = entries[0].instruction;
+	const Instruction& jp = entries[1].instruction;
+
+	enter_fused(entries[0]);
+
+	Operands o = fetch_operands<OperandKind::Register, OperandKind::None>(dec);
+
+	write_result<OperandKind::Register>(dec, o.dest_value, o.operand1 - 1);
+
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+
+	Operands target = fetch_operands<OperandKind::Absolute, OperandKind::None>(jp);
+
+	if (jp.condition == Instruction::Conditions::NZ) {
+		branch_taken = o.operand1 != 1;
+	}
+	else if (jp.condition == Instruction::Conditions::Z) {
+		branch_taken = o.operand1 == 1;
+	}
+	else {
+		set_flags(FlagTables::dec[o.operand1]);
+
+		condition_met(jp.condition);
+	}
+
+	if (branch_taken) {
+		registers.PC = target.dest_value;
+	}
+
+	finish<OperandKind::Absolute>(jp, target, 0);
+
+	retire_fused(entries[1], branch_taken);
+}
+
+// JR takes no notice of its condition, so the flags of DEC are never seen.
+void Soft80::fused_DEC_JR(const CachedInstruction* entries, const BasicBlock&) {
+	const Instruction& dec = entries[0].instruction;
+	const Instruction& jr = entries[1].instruction;
+
+	enter_fused(entries[0]);
+
+	Operands o = fetch_operands<OperandKind::Register, OperandKind::None>(dec);
+
+	write_result<OperandKind::Register>(dec, o.dest_value, o.operand1 - 1);
+
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+
+	registers.PC = registers.PC + jr.displacement;
+	branch_taken = true;
+
+	set_flags(0);
+
+	retire_fused(entries[1], true);
+}
+
+// The flags DEC defers replace the ones the load clears.
+void Soft80::fused_LD_DEC(const CachedInstruction* entries, const BasicBlock&) {
+	const Instruction& ld = entries[0].instruction;
+
+	enter_fused(entries[0]);
+
+	registers.write<false>(ld.dest, ld.imm);
+
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+	op_DEC<OperandKind::Register, OperandKind::None>(entries[1].instruction);
+	retire_fused(entries[1], false);
+}
+
+void Soft80::fused_LD_INC(const CachedInstruction* entries, const BasicBlock&) {
+	const Instruction& ld = entries[0].instruction;
+
+	enter_fused(entries[0]);
+
+	Operands o = fetch_operands<OperandKind::Register, OperandKind::Indirect>(ld);
+
+	write_result<OperandKind::Register>(ld, o.dest_value, o.operand2);
+
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+	op_INC<OperandKind::Pair, OperandKind::None>(entries[1].instruction);
+	retire_fused(entries[1], false);
+}
+
+void Soft80::fused_LD_OUT(const CachedInstruction* entries, const BasicBlock&) {
+	const Instruction& ld = entries[0].instruction;
+
+	enter_fused(entries[0]);
+
+	registers.write<false>(ld.dest, ld.imm);
+
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+	op_OUT<OperandKind::Indirect, OperandKind::Register>(entries[1].instruction);
+	retire_fused(entries[1], false);
+}
+
+// The first push may write over the block, and then the second is not
+// run from it.
+void Soft80::fused_PUSH_PUSH(const CachedInstruction* entries, const BasicBlock& block) {
+	enter_fused(entries[0]);
+	op_PUSH<OperandKind::None, OperandKind::Pair>(entries[0].instruction);
+	retire_fused(entries[0], false);
+
+	if (!block.valid) {
+		return;
+	}
+
+	enter_fused(entries[1]);
+	op_PUSH<OperandKind::None, OperandKind::Pair>(entries[1].instruction);
+	retire_fused(entries[1], false);
+}
+
+void Soft80::fused_POP_POP(const CachedInstruction* entries, const BasicBlock&) {
+	enter_fused(entries[0]);
+	op_POP<OperandKind::Pair, OperandKind::None>(entries[0].instruction);
+	retire_fused(entries[0], false);
+
+	enter_fused(entries[1]);
+	op_POP<OperandKind::Pair, OperandKind::None>(entries[1].instruction);
+	retire_fused(entries[1], false);
+}
@@ -31,11 +31,14 @@ int main(int argc, char** argv) {
 		auto now = std::chrono::steady_clock::now();
 		auto delta = now - start;
 
-		if (delta.count() >= (MHZ4)) {
-			start = now;
-		
-			zcpu.cycle_clock();
-			term.cycle_clock();
+		size_t ticks = delta.count() / MHZ4;
+
+		// Whatever clocks have come due since the last pass, in one grant.
+		if (ticks > 0) {
+			start += std::chrono::nanoseconds(ticks * MHZ4);
+
+			zcpu.cycle_clock(ticks);
+			term.cycle_clock(ticks);
 		}
 	}
 
@@ -0,0 +1,843 @@
+#include "recompiler.h"
+#include "soft80.h"
+#include "flagtables.h"
+
+#include <array>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SOFT80_RECOMPILER_X64 1
+#else
+#define SOFT80_RECOMPILER_X64 0
+#endif
+
+#if SOFT80_RECOMPILER_X64
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace {
+
+	enum Reg : uint8_t {
+		RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+
+#if defined(_WIN32)
+	const uint8_t Arg0 = RCX;
+	const uint8_t Arg1 = RDX;
+	const uint8_t Arg2 = R8;
+#else
+	const uint8_t Arg0 = RDI;
+	const uint8_t Arg1 = RSI;
+	const uint8_t Arg2 = RDX;
+#endif
+
+	// Pinned Z80 registers. Each pair lives zero-extended in a callee-saved
+	// host register, so it survives calls back into the interpreter.
+	const uint8_t PinnedAF = R12;
+	const uint8_t PinnedBC = R13;
+	const uint8_t PinnedDE = R14;
+	const uint8_t PinnedHL = R15;
+	const uint8_t PinnedSP = RBX;
+
+	const uint8_t CondZ = 0x4;
+	const uint8_t CondNZ = 0x5;
+
+	uint8_t condition_mask(Instruction::Conditions condition) {
+		switch (condition) {
+		case Instruction::Conditions::NZ:
+		case Instruction::Conditions::Z:
+			return FlagBits::Zero;
+		case Instruction::Conditions::NC:
+		case Instruction::Conditions::C:
+			return FlagBits::Carry;
+		case Instruction::Conditions::PO:
+		case Instruction::Conditions::PE:
+			return FlagBits::Overflow;
+		case Instruction::Conditions::P:
+		case Instruction::Conditions::M:
+			return FlagBits::Sign;
+		default:
+			break;
+		}
+
+		return 0;
+	}
+
+	// NZ, NC, PO and P are taken when their flag is clear.
+	bool taken_when_clear(Instruction::Conditions condition) {
+		return static_cast<int>(condition) % 2 == 0;
+	}
+
+}
+
+class Recompiler::Assembler {
+
+public:
+
+	std::vector<uint8_t> code;
+
+	void byte(uint8_t b) {
+		code.push_back(b);
+	}
+
+	void imm16(uint16_t v) {
+		byte(v & 0xFF);
+		byte(v >> 8);
+	}
+
+	void imm32(uint32_t v) {
+		for (size_t i = 0; i < 4; i++) {
+			byte((v >> (i * 8)) & 0xFF);
+		}
+	}
+
+	void imm64(uint64_t v) {
+		for (size_t i = 0; i < 8; i++) {
+			byte((v >> (i * 8)) & 0xFF);
+		}
+	}
+
+	void rex(bool wide, uint8_t reg, uint8_t rm, bool force = false) {
+		uint8_t prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+
+		if (prefix != 0x40 || force) {
+			byte(prefix);
+		}
+	}
+
+	void modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+		byte((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	// [base + disp]; base must be RAX or RCX.
+	void mem(uint8_t reg, uint8_t base, int32_t disp) {
+		if (disp == 0) {
+			modrm(0, reg, base);
+		}
+		else {
+			modrm(2, reg, base);
+			imm32(disp);
+		}
+	}
+
+	void mov(uint8_t dst, uint8_t src) {
+		rex(false, src, dst);
+		byte(0x89);
+		modrm(3, src, dst);
+	}
+
+	void or_(uint8_t dst, uint8_t src) {
+		rex(false, src, dst);
+		byte(0x09);
+		modrm(3, src, dst);
+	}
+
+	void xchg(uint8_t a, uint8_t b) {
+		rex(false, b, a);
+		byte(0x87);
+		modrm(3, b, a);
+	}
+
+	void mov_imm(uint8_t dst, uint32_t v) {
+		rex(false, 0, dst);
+		byte(0xB8 + (dst & 7));
+		imm32(v);
+	}
+
+	void mov_imm64(uint8_t dst, uint64_t v) {
+		rex(true, 0, dst);
+		byte(0xB8 + (dst & 7));
+		imm64(v);
+	}
+
+	void mov_ptr(uint8_t dst, const void* p) {
+		mov_imm64(dst, reinterpret_cast<uint64_t>(p));
+	}
+
+	void alu_imm(uint8_t ext, uint8_t dst, uint32_t v) {
+		rex(false, 0, dst);
+		byte(0x81);
+		modrm(3, ext, dst);
+		imm32(v);
+	}
+
+	void add_imm(uint8_t dst, uint32_t v) { alu_imm(0, dst, v); }
+	void and_imm(uint8_t dst, uint32_t v) { alu_imm(4, dst, v); }
+	void sub_imm(uint8_t dst, uint32_t v) { alu_imm(5, dst, v); }
+
+	void test_imm(uint8_t dst, uint32_t v) {
+		rex(false, 0, dst);
+		byte(0xF7);
+		modrm(3, 0, dst);
+		imm32(v);
+	}
+
+	void test8(uint8_t a, uint8_t b) {
+		rex(false, b, a, true);
+		byte(0x84);
+		modrm(3, b, a);
+	}
+
+	void shift_imm(uint8_t ext, uint8_t dst, uint8_t count) {
+		rex(false, 0, dst);
+		byte(0xC1);
+		modrm(3, ext, dst);
+		byte(count);
+	}
+
+	void shl(uint8_t dst, uint8_t count) { shift_imm(4, dst, count); }
+	void shr(uint8_t dst, uint8_t count) { shift_imm(5, dst, count); }
+
+	void movzx8(uint8_t dst, uint8_t src) {
+		rex(false, dst, src, true);
+		byte(0x0F);
+		byte(0xB6);
+		modrm(3, dst, src);
+	}
+
+	void mov8(uint8_t dst, uint8_t src) {
+		rex(false, src, dst, true);
+		byte(0x88);
+		modrm(3, src, dst);
+	}
+
+	void load8(uint8_t dst, uint8_t base, int32_t disp = 0) {
+		rex(false, dst, base);
+		byte(0x0F);
+		byte(0xB6);
+		mem(dst, base, disp);
+	}
+
+	// movzx dst, byte [base + index]
+	void load8_indexed(uint8_t dst, uint8_t base, uint8_t index) {
+		rex(false, dst, base);
+		byte(0x0F);
+		byte(0xB6);
+		modrm(0, dst, RSP);
+		byte(((index & 7) << 3) | (base & 7));
+	}
+
+	void store8(uint8_t base, uint8_t src, int32_t disp = 0) {
+		rex(false, src, base, true);
+		byte(0x88);
+		mem(src, base, disp);
+	}
+
+	void load16(uint8_t dst, uint8_t base, int32_t disp = 0) {
+		rex(false, dst, base);
+		byte(0x0F);
+		byte(0xB7);
+		mem(dst, base, disp);
+	}
+
+	void store16(uint8_t base, uint8_t src, int32_t disp = 0) {
+		byte(0x66);
+		rex(false, src, base);
+		byte(0x89);
+		mem(src, base, disp);
+	}
+
+	void store16_imm(uint8_t base, uint16_t v, int32_t disp = 0) {
+		byte(0x66);
+		rex(false, 0, base);
+		byte(0xC7);
+		mem(0, base, disp);
+		imm16(v);
+	}
+
+	void add64_imm(uint8_t base, uint32_t v, int32_t disp = 0) {
+		rex(true, 0, base);
+		byte(0x81);
+		mem(0, base, disp);
+		imm32(v);
+	}
+
+	void cmp8_imm(uint8_t base, uint8_t v, int32_t disp = 0) {
+		rex(false, 0, base);
+		byte(0x80);
+		mem(7, base, disp);
+		byte(v);
+	}
+
+	void push(uint8_t r) {
+		rex(false, 0, r);
+		byte(0x50 + (r & 7));
+	}
+
+	void pop(uint8_t r) {
+		rex(false, 0, r);
+		byte(0x58 + (r & 7));
+	}
+
+	void adjust_rsp(int8_t v) {
+		byte(0x48);
+		byte(0x83);
+		byte(v < 0 ? 0xEC : 0xC4);
+		byte(v < 0 ? -v : v);
+	}
+
+	void call(const void* fn) {
+		mov_ptr(RAX, fn);
+		byte(0xFF);
+		byte(0xD0);
+	}
+
+	void ret() {
+		byte(0xC3);
+	}
+
+	// Jumps return the offset of their rel32 field for bind().
+	size_t jcc(uint8_t condition) {
+		byte(0x0F);
+		byte(0x80 | condition);
+		imm32(0);
+
+		return code.size() - 4;
+	}
+
+	size_t jmp() {
+		byte(0xE9);
+		imm32(0);
+
+		return code.size() - 4;
+	}
+
+	void bind(size_t patch) {
+		uint32_t rel = static_cast<uint32_t>(code.size() - (patch + 4));
+
+		std::memcpy(&code[patch], &rel, sizeof(rel));
+	}
+
+};
+
+Recompiler::Recompiler(Soft80& cpu) : cpu(cpu) {}
+
+Recompiler::~Recompiler() {
+#if SOFT80_RECOMPILER_X64
+	if (buffer) {
+#if defined(_WIN32)
+		VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+		munmap(buffer, BufferSize);
+#endif
+	}
+#endif
+}
+
+bool Recompiler::is_supported() {
+	return SOFT80_RECOMPILER_X64;
+}
+
+void Recompiler::reset() {
+	buffer_used = 0;
+}
+
+BasicBlock::NativeCode Recompiler::compile(const BasicBlock& block) {
+#if SOFT80_RECOMPILER_X64
+	Assembler a;
+	BlockState state;
+
+	for (uint8_t r : { RBX, RBP, R12, R13, R14, R15 }) {
+		a.push(r);
+	}
+
+	// Six pushes leave the stack 8 bytes off; the rest is shadow space.
+	a.adjust_rsp(-40);
+
+	emit_reload(a);
+
+	uint16_t address = block.start;
+	bool ended_in_interpreter = false;
+
+	for (size_t i = 0; i < block.instructions.size(); i++) {
+		const CachedInstruction& entry = block.instructions[i];
+
+		uint16_t next = address + entry.length;
+		bool last = i + 1 == block.instructions.size();
+
+		if (!emit_native(a, state, block, entry, next)) {
+			emit_interpreter_call(a, state, block, entry, address, last);
+
+			ended_in_interpreter = last;
+		}
+
+		address = next;
+	}
+
+	if (!ended_in_interpreter) {
+		if (!state.pc_in_eax) {
+			a.mov_imm(RAX, block.end);
+		}
+
+		a.mov_ptr(RCX, &cpu.registers.PC);
+		a.store16(RCX, RAX);
+
+		emit_flush_t_cycles(a, state);
+		emit_spill(a);
+	}
+
+	for (size_t exit : state.exits) {
+		a.bind(exit);
+	}
+
+	a.adjust_rsp(40);
+
+	for (uint8_t r : { R15, R14, R13, R12, RBP, RBX }) {
+		a.pop(r);
+	}
+
+	a.ret();
+
+	if (!buffer) {
+#if defined(_WIN32)
+		buffer = static_cast<uint8_t*>(VirtualAlloc(nullptr, BufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+		void* mapped = mmap(nullptr, BufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		buffer = mapped == MAP_FAILED ? nullptr : static_cast<uint8_t*>(mapped);
+#endif
+
+		if (!buffer) {
+			return nullptr;
+		}
+	}
+
+	if (a.code.size() > BufferSize - buffer_used) {
+		return nullptr;
+	}
+
+	uint8_t* code = buffer + buffer_used;
+
+#if defined(_WIN32)
+	DWORD old_protect;
+
+	VirtualProtect(buffer, BufferSize, PAGE_READWRITE, &old_protect);
+	std::memcpy(code, a.code.data(), a.code.size());
+	VirtualProtect(buffer, BufferSize, PAGE_EXECUTE_READ, &old_protect);
+	FlushInstructionCache(GetCurrentProcess(), code, a.code.size());
+#else
+	mprotect(buffer, BufferSize, PROT_READ | PROT_WRITE);
+	std::memcpy(code, a.code.data(), a.code.size());
+	mprotect(buffer, BufferSize, PROT_READ | PROT_EXEC);
+#endif
+
+	// Keep entry points 16-byte aligned.
+	buffer_used += (a.code.size() + 15) & ~size_t(15);
+
+	return reinterpret_cast<BasicBlock::NativeCode>(code);
+#else
+	return nullptr;
+#endif
+}
+
+bool Recompiler::emit_native(Assembler& a, BlockState& state, const BasicBlock& block, const CachedInstruction& entry, uint16_t next) {
+	using Names = Instruction::Names;
+	using Regs = RegisterFile::Names;
+
+	const Instruction& instruction = entry.instruction;
+
+	uint32_t fetch_t_cycles = 4 * entry.length;
+
+	std::optional<Slot> dest8 = slot8(instruction.dest);
+	std::optional<Slot> source8 = slot8(instruction.source);
+	std::optional<uint8_t> dest16 = reg16(instruction.dest);
+	std::optional<uint8_t> source16 = reg16(instruction.source);
+
+	bool plain = !instruction.addr_dest && !instruction.addr_source;
+
+	switch (instruction.name) {
+	case Names::NOP:
+		emit_clear_flags(a);
+
+		state.pending_t_cycles += fetch_t_cycles;
+
+		return true;
+
+	case Names::LD:
+		if (plain && dest8 && source8) {
+			emit_load8(a, source8.value());
+			emit_clear_flags(a);
+			emit_store8(a, dest8.value());
+
+			state.pending_t_cycles += fetch_t_cycles;
+
+			return true;
+		}
+
+		if (plain && instruction.source == Regs::Immediate && (dest8 || dest16)) {
+			if (dest8) {
+				a.mov_imm(RAX, instruction.imm & 0xFF);
+				emit_clear_flags(a);
+				emit_store8(a, dest8.value());
+			}
+			else {
+				a.mov_imm(dest16.value(), instruction.imm);
+				emit_clear_flags(a);
+			}
+
+			state.pending_t_cycles += fetch_t_cycles;
+
+			return true;
+		}
+
+		// LD r,(nn) and LD rr,(nn), the latter loading a single byte. The
+		// mapping is looked up once, here, so unmapped addresses are left to
+		// the interpreter: a block is not rebuilt when memory is mapped there
+		// later.
+		if (instruction.addr_source && !instruction.addr_dest
+			&& instruction.source == Regs::Immediate && (dest8 || dest16)) {
+
+			uint16_t address = instruction.imm + instruction.displacement;
+
+			const MemoryMap::Mapping* mapping = cpu.memory.find_mapping(address);
+
+			uint8_t* host = mapping ? mapping->direct_pointer(address) : nullptr;
+
+			if (!host) {
+				return false;
+			}
+
+			a.mov_ptr(RCX, host);
+			a.load8(RAX, RCX);
+
+			emit_clear_flags(a);
+
+			if (dest8) {
+				emit_store8(a, dest8.value());
+			}
+			else {
+				a.mov(dest16.value(), RAX);
+			}
+
+			state.pending_t_cycles += fetch_t_cycles + 3;
+
+			return true;
+		}
+
+		// LD (nn),r and LD (nn),rr, the latter storing the low byte. The
+		// destination is read first, which is harmless for plain memory.
+		// Unmapped addresses are left to the interpreter, as for loads.
+		if (instruction.addr_dest && !instruction.addr_source
+			&& instruction.dest == Regs::Immediate && (source8 || source16)) {
+
+			uint16_t address = instruction.imm + instruction.displacement;
+
+			const MemoryMap::Mapping* mapping = cpu.memory.find_mapping(address);
+
+			uint8_t* host = mapping ? mapping->direct_pointer(address) : nullptr;
+
+			if (!host || cpu.memory.mapping_count(address) > 1) {
+				return false;
+			}
+
+			if (source8) {
+				emit_load8(a, source8.value());
+			}
+			else {
+				a.mov(RAX, source16.value());
+			}
+
+			emit_clear_flags(a);
+
+			state.pending_t_cycles += fetch_t_cycles + 6;
+
+			if (mapping->is_mutable) {
+				a.mov_ptr(RCX, host);
+				a.store8(RCX, RAX);
+
+				emit_flush_t_cycles(a, state);
+
+				a.mov_ptr(RCX, cpu.instruction_cache.code_page_flag(address));
+				a.cmp8_imm(RCX, 0);
+
+				size_t no_code = a.jcc(CondZ);
+
+				emit_store_pc(a, next);
+				emit_spill(a);
+
+				a.mov_ptr(Arg0, &cpu);
+				a.mov_imm(Arg1, address);
+				a.mov_ptr(Arg2, &block);
+
+				a.call(reinterpret_cast<const void*>(&Recompiler::call_notify_write));
+
+				a.test8(RAX, RAX);
+				state.exits.push_back(a.jcc(CondZ));
+
+				a.bind(no_code);
+			}
+
+			return true;
+		}
+
+		return false;
+
+	case Names::EX:
+		if (plain && instruction.dest == Regs::DE && instruction.source == Regs::HL) {
+			a.xchg(PinnedDE, PinnedHL);
+			emit_clear_flags(a);
+
+			state.pending_t_cycles += fetch_t_cycles;
+
+			return true;
+		}
+
+		return false;
+
+	case Names::INC:
+	case Names::DEC:
+		if (plain && dest8 && instruction.source == Regs::None) {
+			const std::array<uint8_t, 256>& table = instruction.name == Names::INC ? FlagTables::inc : FlagTables::dec;
+
+			emit_load8(a, dest8.value());
+
+			a.mov_ptr(RCX, table.data());
+			a.load8_indexed(RCX, RCX, RAX);
+			a.mov8(PinnedAF, RCX);
+
+			if (instruction.name == Names::INC) {
+				a.add_imm(RAX, 1);
+			}
+			else {
+				a.sub_imm(RAX, 1);
+			}
+
+			emit_store8(a, dest8.value());
+
+			state.pending_t_cycles += fetch_t_cycles;
+
+			return true;
+		}
+
+		return false;
+
+	case Names::JP:
+	{
+		// JP nn reads its target and writes 0 back to it, so only targets
+		// where neither has an effect are lowered: mapped, but read-only.
+		if (instruction.dest != Regs::Immediate || !instruction.addr_dest || instruction.addr_source) {
+			return false;
+		}
+
+		uint16_t target = instruction.imm;
+
+		const MemoryMap::Mapping* mapping = cpu.memory.find_mapping(target);
+
+		if (!mapping || mapping->is_mutable || !mapping->direct_pointer(target)) {
+			return false;
+		}
+
+		if (instruction.condition == Instruction::Conditions::None) {
+			emit_clear_flags(a);
+			a.mov_imm(RAX, target);
+		}
+		else {
+			a.test_imm(PinnedAF, condition_mask(instruction.condition));
+
+			size_t not_taken = a.jcc(taken_when_clear(instruction.condition) ? CondNZ : CondZ);
+
+			a.mov_imm(RAX, target);
+
+			size_t done = a.jmp();
+
+			a.bind(not_taken);
+			a.mov_imm(RAX, next);
+			a.bind(done);
+
+			emit_clear_flags(a);
+		}
+
+		state.pending_t_cycles += fetch_t_cycles + 6;
+		state.pc_in_eax = true;
+
+		return true;
+	}
+
+	case Names::JR:
+		// Taken regardless of the condition, as in the interpreter.
+		emit_clear_flags(a);
+		a.mov_imm(RAX, static_cast<uint16_t>(next + instruction.displacement));
+
+		state.pending_t_cycles += fetch_t_cycles;
+		state.pc_in_eax = true;
+
+		return true;
+
+	case Names::DJNZ:
+	{
+		Slot b = slot8(Regs::B).value();
+
+		emit_clear_flags(a);
+		emit_load8(a, b);
+		a.sub_imm(RAX, 1);
+		emit_store8(a, b);
+		a.test8(RAX, RAX);
+
+		size_t not_taken = a.jcc(CondZ);
+
+		a.mov_imm(RAX, static_cast<uint16_t>(next + instruction.displacement));
+
+		size_t done = a.jmp();
+
+		a.bind(not_taken);
+		a.mov_imm(RAX, next);
+		a.bind(done);
+
+		state.pending_t_cycles += fetch_t_cycles;
+		state.pc_in_eax = true;
+
+		return true;
+	}
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+void Recompiler::emit_interpreter_call(Assembler& a, BlockState& state, const BasicBlock& block, const CachedInstruction& entry, uint16_t address, bool last) {
+	emit_flush_t_cycles(a, state);
+	emit_store_pc(a, address);
+	emit_spill(a);
+
+	a.mov_ptr(Arg0, &cpu);
+	a.mov_ptr(Arg1, &entry);
+	a.mov_ptr(Arg2, &block);
+	a.call(reinterpret_cast<const void*>(&Recompiler::call_interpreter));
+
+	if (last) {
+		return;
+	}
+
+	a.test8(RAX, RAX);
+	state.exits.push_back(a.jcc(CondZ));
+
+	emit_reload(a);
+}
+
+void Recompiler::emit_flush_t_cycles(Assembler& a, BlockState& state) {
+	if (state.pending_t_cycles == 0) {
+		return;
+	}
+
+	a.mov_ptr(RCX, &cpu.total_t_cycles);
+	a.add64_imm(RCX, state.pending_t_cycles);
+	a.mov_ptr(RCX, &cpu.current_t_cycles);
+	a.add64_imm(RCX, state.pending_t_cycles);
+
+	state.pending_t_cycles = 0;
+}
+
+void Recompiler::emit_store_pc(Assembler& a, uint16_t pc) {
+	a.mov_ptr(RCX, &cpu.registers.PC);
+	a.store16_imm(RCX, pc);
+}
+
+void Recompiler::emit_spill(Assembler& a) {
+	GeneralRegisters& main = cpu.registers.main;
+
+	a.mov_ptr(RCX, &main.AF);
+	a.store16(RCX, PinnedAF);
+	a.store16(RCX, PinnedBC, offsetof(GeneralRegisters, BC));
+	a.store16(RCX, PinnedDE, offsetof(GeneralRegisters, DE));
+	a.store16(RCX, PinnedHL, offsetof(GeneralRegisters, HL));
+
+	a.mov_ptr(RCX, &cpu.registers.SP);
+	a.store16(RCX, PinnedSP);
+}
+
+void Recompiler::emit_reload(Assembler& a) {
+	GeneralRegisters& main = cpu.registers.main;
+
+	a.mov_ptr(RCX, &main.AF);
+	a.load16(PinnedAF, RCX);
+	a.load16(PinnedBC, RCX, offsetof(GeneralRegisters, BC));
+	a.load16(PinnedDE, RCX, offsetof(GeneralRegisters, DE));
+	a.load16(PinnedHL, RCX, offsetof(GeneralRegisters, HL));
+
+	a.mov_ptr(RCX, &cpu.registers.SP);
+	a.load16(PinnedSP, RCX);
+}
+
+// Leaves the register zero-extended in EAX.
+void Recompiler::emit_load8(Assembler& a, Slot slot) {
+	a.mov(RAX, slot.reg);
+
+	if (slot.high) {
+		a.shr(RAX, 8);
+	}
+
+	a.movzx8(RAX, RAX);
+}
+
+// Stores AL, leaving it intact.
+void Recompiler::emit_store8(Assembler& a, Slot slot) {
+	if (!slot.high) {
+		a.mov8(slot.reg, RAX);
+		return;
+	}
+
+	a.movzx8(RCX, RAX);
+	a.shl(RCX, 8);
+	a.and_imm(slot.reg, 0x00FF);
+	a.or_(slot.reg, RCX);
+}
+
+void Recompiler::emit_clear_flags(Assembler& a) {
+	a.and_imm(PinnedAF, 0xFF00);
+}
+
+std::optional<Recompiler::Slot> Recompiler::slot8(RegisterFile::Names name) {
+	switch (name) {
+	case RegisterFile::Names::A: return Slot{ PinnedAF, true };
+	case RegisterFile::Names::B: return Slot{ PinnedBC, true };
+	case RegisterFile::Names::C: return Slot{ PinnedBC, false };
+	case RegisterFile::Names::D: return Slot{ PinnedDE, true };
+	case RegisterFile::Names::E: return Slot{ PinnedDE, false };
+	case RegisterFile::Names::H: return Slot{ PinnedHL, true };
+	case RegisterFile::Names::L: return Slot{ PinnedHL, false };
+	default: break;
+	}
+
+	return std::nullopt;
+}
+
+std::optional<uint8_t> Recompiler::reg16(RegisterFile::Names name) {
+	switch (name) {
+	case RegisterFile::Names::BC: return PinnedBC;
+	case RegisterFile::Names::DE: return PinnedDE;
+	case RegisterFile::Names::HL: return PinnedHL;
+	case RegisterFile::Names::SP: return PinnedSP;
+	default: break;
+	}
+
+	return std::nullopt;
+}
+
+// Generated code has no unwind tables, so a fiber unwinding from a stall
+// in here leaves the block first and is thrown again by run_blocks().
+bool Recompiler::call_interpreter(Soft80* cpu, const CachedInstruction* entry, const BasicBlock* block) {
+	try {
+		cpu->execute_cached(*entry);
+	}
+	catch (const Fiber::Unwind&) {
+		return false;
+	}
+
+	cpu->materialize_flags();
+
+	return block->valid;
+}
+
+bool Recompiler::call_notify_write(Soft80* cpu, uint32_t address, const BasicBlock* block) {
+	cpu->memory.notify_write(address, address);
+
+	return block->valid;
+}
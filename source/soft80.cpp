@@ -1,2393 +1,1406 @@
 #include "soft80.h"
 
-Soft80::Soft80() {
-	execution_thread = std::thread(&Soft80::executor, this);
+#include <iomanip>
+
+Soft80::Soft80(ExecutionMode mode) : execution_mode(mode) {
+	memory.add_write_watcher([this](uint16_t low, uint16_t high) {
+		instruction_cache.invalidate(low, high);
+		block_cache.invalidate(low, high);
+	});
+
+	if (execution_mode == ExecutionMode::Threaded) {
+		execution_thread = std::thread(&Soft80::executor, this);
+	}
+	else if (execution_mode == ExecutionMode::Cooperative) {
+		fiber = std::make_unique<Fiber>([this] { executor(); });
+	}
+	else {
+		sync_fiber = std::make_unique<Fiber>([this] { synchronous_executor(); });
+	}
 }
 
 Soft80::~Soft80() {
-	should_executor_exit = true;
-	execution_thread.join();
+	kill();
+
+	if (execution_thread.joinable()) {
+		execution_thread.join();
+	}
+
+	// Unwinds a suspended executor while the state its frames refer to is
+	// still there.
+	if (fiber) {
+		fiber->unwind();
+	}
+
+	if (sync_fiber) {
+		sync_fiber->unwind();
+	}
+}
+
+uint32_t Soft80::read_pins() {
+	return pins.load(std::memory_order_acquire);
 }
 
 bool Soft80::read_busack() {
-	return busack;
+	return pins.load(std::memory_order_acquire) & PinBits::BUSACK;
 }
 
 bool Soft80::read_halt() {
-	return halt;
+	return pins.load(std::memory_order_acquire) & PinBits::HALT;
 }
 
 bool Soft80::read_iorq() {
-	return iorq;
+	return pins.load(std::memory_order_acquire) & PinBits::IORQ;
 }
 
 bool Soft80::read_m1() {
-	return m1;
+	return pins.load(std::memory_order_acquire) & PinBits::M1;
 }
 
 bool Soft80::read_mreq() {
-	return mreq;
+	return pins.load(std::memory_order_acquire) & PinBits::MREQ;
 }
 
 bool Soft80::read_rd() {
-	return rd;
+	return pins.load(std::memory_order_acquire) & PinBits::RD;
 }
 
 bool Soft80::read_wr() {
-	return wr;
+	return pins.load(std::memory_order_acquire) & PinBits::WR;
 }
 
 bool Soft80::read_rfsh() {
-	return rfsh;
+	return pins.load(std::memory_order_acquire) & PinBits::RFSH;
 }
 
-void Soft80::add_busreq_source(bool& b) {
-	busreq_sources.push_back(&b);
+void Soft80::set_busreq(bool asserted) {
+	set_event(EventBits::BUSREQ, asserted);
 }
 
-void Soft80::add_reset_source(bool& b) {
-	reset_sources.push_back(&b);
+void Soft80::set_reset(bool asserted) {
+	set_event(EventBits::RESET, asserted);
+
+	if (asserted) {
+		wake();
+	}
 }
 
-void Soft80::add_wait_source(bool& b) {
-	wait_sources.push_back(&b);
+void Soft80::set_wait(bool asserted) {
+	set_event(EventBits::WAIT, asserted);
 }
 
 void Soft80::signal_int() {
-	int_latch = true;
+	set_event(EventBits::INT, true);
+
+	wake();
 }
 
 void Soft80::signal_nmi() {
-	nmi_latch = true;
+	set_event(EventBits::NMI, true);
+
+	wake();
 }
 
-void Soft80::cycle_clock() {
-	should_cycle = true;
+void Soft80::place_vector(uint8_t vector) {
+	data_bus = vector;
+
+	set_event(EventBits::VECTOR, true);
 
-	total_t_cycles++;
-	current_t_cycles++;
+	wake();
 }
 
-void Soft80::kill() {
-	should_executor_exit = true;
+// Only the executor drives the pins, so it can store the word whole.
+void Soft80::set_pins(uint32_t bits, bool asserted) {
+	uint32_t levels = pins.load(std::memory_order_relaxed);
+
+	pins.store(asserted ? levels | bits : levels & ~bits, std::memory_order_release);
 }
 
-void Soft80::executor() {
-	while (!should_executor_exit) {
+// Drives the bus control pins to levels all at once, so that a device never
+// sees a mix of two cycles.
+void Soft80::set_bus_pins(uint32_t levels) {
+	uint32_t others = pins.load(std::memory_order_relaxed) & ~PinBits::Bus;
 
-		if (read_reset()) {
-			wait_next_clock();
-
-			busack = false;
-			halt = false;
-			iorq = false;
-			m1 = false;
-			mreq = false;
-			rd = false;
-			wr = false;
-			rfsh = false;
-
-			wait_next_clock();
-			wait_next_clock();
-
-			if (read_reset()) {
-				iff1 = false;
-				registers.PC = 0;
-				registers.I = 0;
-				registers.R = 0;
-				interrupt_mode = 0;
-			}
-		}
-		
-		if (!halt) {
-			fetch_opcode();
-		}
-		else {
-			wait_next_clock();
+	pins.store(others | levels, std::memory_order_release);
+}
+
+void Soft80::set_event(uint32_t bit, bool asserted) {
+	if (asserted) {
+		pending_events.fetch_or(bit);
+	}
+	else {
+		pending_events.fetch_and(~bit);
+	}
+}
 
-			iorq = false;
-			m1 = true;
-			mreq = false;
-			rd = false;
-			wr = false;
-			rfsh = false;
+// Clears a latched request, saying whether it was there.
+bool Soft80::take_event(uint32_t bit) {
+	return pending_events.fetch_and(~bit) & bit;
+}
 
-			wait_next_clock();
-			wait_next_clock();
+size_t Soft80::cycle_clock(size_t t_cycles) {
+	clock_granted += t_cycles;
+	clock_credit.fetch_add(t_cycles, std::memory_order_release);
 
-			m1 = false;
+	if (clock_wait == ClockWait::Block) {
+		clock_credit.notify_one();
+	}
 
-			wait_next_clock();
+	if (fiber && !should_executor_exit) {
+		fiber->resume();
+	}
 
-			current_instruction = Instruction{};
-		}
+	size_t used = clock_granted - std::min(clock_granted, clock_credit.load(std::memory_order_acquire));
 
-		if (current_instruction) {
-			int_response = false;
+	if (used <= clock_reported) {
+		return 0;
+	}
 
-			if (current_instruction->name != Instruction::Names::NOP) {
-				instruction_history.push(current_instruction.value());
-			}
+	return used - std::exchange(clock_reported, used);
+}
+
+void Soft80::set_clock_wait(ClockWait wait) {
+	clock_wait = wait;
+}
 
-			execute_instruction();
+void Soft80::kill() {
+	should_executor_exit = true;
 
-			if (nmi_latch) {
-				nmi_latch = false;
+	wake();
 
-				nmi_acknowledge();
-			}
+	// Lets an executor blocked on the clock see the flag.
+	clock_credit.fetch_add(1, std::memory_order_release);
+	clock_credit.notify_all();
+}
+
+void Soft80::wake() {
+	wakeups++;
+	wakeups.notify_all();
+}
 
-			if (int_latch && iff1) {
-				int_latch = false;
+// The device answers from its own thread or fiber, in its own time. The
+// executor sleeps on the wakeups until then, as it does when halted.
+void Soft80::wait_for_vector() {
+	while (!take_event(EventBits::VECTOR)) {
+		if (fiber) {
+			fiber->suspend();
 
-				int_acknowledge();
-			}
+			continue;
 		}
 
-	}
-}
+		uint32_t seen = wakeups.load(std::memory_order_acquire);
+
+		if (pending_events.load(std::memory_order_acquire) & EventBits::VECTOR) {
+			continue;
+		}
 
-void Soft80::wait_next_clock() {
-	while (!should_cycle || read_wait()) {
 		if (should_executor_exit) {
 			exit(0);
 		}
 
-		std::this_thread::yield();
+		wakeups.wait(seen);
 	}
+}
+
+bool Soft80::interrupt_pending() {
+	uint32_t events = pending_events.load(std::memory_order_acquire);
 
-	should_cycle = false;
+	return (events & EventBits::NMI) || ((events & EventBits::INT) && iff1);
 }
 
-void Soft80::fetch_opcode() {
-	wait_next_clock();
+// The clock keeps running while the executor sleeps. Clock that arrived
+// while it was blocked is spent in whole halt cycles; the rest is left for
+// the halt cycles that follow. Credit already there is run through as
+// halt cycles before the executor sleeps at all.
+void Soft80::sleep_while_halted() {
+	size_t slept = 0;
 
-	if (!int_response) {
-		update_m_cycle(M_Cycles::OpcodeFetch);
+	while (!should_executor_exit) {
+		uint32_t seen = wakeups;
+
+		if (interrupt_pending() || read_reset() || should_executor_exit) {
+			break;
+		}
+
+		if (slept == 0 && clock_credit.load(std::memory_order_acquire) >= 4) {
+			break;
+		}
+
+		size_t before = clock_credit.load(std::memory_order_acquire);
+
+		wakeups.wait(seen);
+
+		// Only the executor takes credit, so it can only have grown.
+		slept += clock_credit.load(std::memory_order_acquire) - before;
 	}
 
-	uint8_t read_byte = 0;
+	slept -= slept % 4;
 
-	if (int_vector) {
-		read_byte = int_vector.value();
-		int_vector = std::nullopt;
+	clock_credit.fetch_sub(slept, std::memory_order_acq_rel);
+
+	total_t_cycles += slept;
+	current_t_cycles += slept;
+}
+
+// Leaves the last halt cycle before the deadline to executor_pass(), so the
+// run still stops on it.
+void Soft80::fast_forward_halt(size_t deadline) {
+	if (interrupt_pending() || !can_run_native() || read_reset() || total_t_cycles >= deadline) {
+		return;
 	}
-	else {
-		iorq = false;
-		m1 = true;
-		mreq = true;
-		rd = true;
-		wr = false;
-		rfsh = false;
 
-		wait_next_clock();
+	size_t cycles = (deadline - total_t_cycles + 3) / 4;
 
-		iorq = false;
-		m1 = true;
-		mreq = true;
-		rd = true;
-		wr = false;
-		rfsh = false;
+	charge_t_cycles(4 * (cycles - 1));
+}
 
-		read_byte = memory.read(registers.PC);
+void Soft80::executor() {
+	while (!should_executor_exit) {
+		executor_pass();
 
-		if (int_response) {
-			read_byte = data_bus;
+		if (accuracy == Accuracy::Functional && !fiber) {
+			// Runs free of the clock, so whatever it grants is spent.
+			clock_debt = 0;
+
+			if (clock_credit.load(std::memory_order_relaxed)) {
+				size_t spent = clock_credit.exchange(0, std::memory_order_acq_rel);
+
+				total_t_cycles += spent;
+				current_t_cycles += spent;
+			}
 		}
 		else {
-			registers.PC++;
+			catch_up_clock();
 		}
+	}
+}
 
+bool Soft80::executor_pass() {
+	if (read_reset()) {
 		wait_next_clock();
 
-		iorq = false;
-		m1 = false;
-		mreq = true;
-		rd = false;
-		wr = false;
-		rfsh = true;
+		set_pins(PinBits::BUSACK | PinBits::HALT, false);
+		set_bus_pins(0);
 
+		wait_next_clock();
 		wait_next_clock();
 
-		iorq = false;
-		m1 = false;
-		mreq = true;
-		rd = false;
-		wr = false;
-		rfsh = true;
+		if (read_reset()) {
+			iff1 = false;
+			registers.PC = 0;
+			registers.I = 0;
+			registers.R = 0;
+			interrupt_mode = 0;
+		}
 	}
 
-	current_instruction = decoder.decode(read_byte);
-}
+	if (!read_halt()) {
+		fetch_opcode();
+	}
+	else {
+		if (execution_mode == ExecutionMode::Threaded) {
+			sleep_while_halted();
+		}
 
-uint8_t Soft80::read_memory(uint16_t address) {
-	wait_next_clock();
+		wait_next_clock();
 
-	update_m_cycle(M_Cycles::MemRead);
+		set_bus_pins(PinBits::M1);
 
-	address_bus = address;
+		wait_next_clock();
+		wait_next_clock();
 
-	iorq = false;
-	m1 = false;
-	mreq = true;
-	rd = true;
-	wr = false;
-	rfsh = false;
+		set_pins(PinBits::M1, false);
 
-	wait_next_clock();
+		wait_next_clock();
 
-	iorq = false;
-	m1 = false;
-	mreq = true;
-	rd = true;
-	wr = false;
-	rfsh = false;
+		current_instruction = Instruction{};
+		current_handler = bind_handler(current_instruction.value());
 
-	wait_next_clock();
+		// The waits above are the whole cost of a halted cycle.
+		current_timing = {};
+	}
 
-	iorq = false;
-	m1 = false;
-	mreq = false;
-	rd = true;
-	wr = false;
-	rfsh = false;
+	if (!current_instruction) {
+		return false;
+	}
 
-	return memory.read(address);
-}
+	int_response = false;
 
-void Soft80::write_memory(uint16_t address, uint8_t value) {
-	wait_next_clock();
+	execute_instruction();
 
-	update_m_cycle(M_Cycles::MemWrite);
+	service_interrupts();
 
-	address_bus = address;
-	data_bus = value;
+	return true;
+}
 
-	iorq = false;
-	m1 = false;
-	mreq = true;
-	rd = false;
-	wr = false;
-	rfsh = false;
+bool Soft80::service_interrupts() {
+	if (!pending_events.load(std::memory_order_acquire)) {
+		return false;
+	}
 
-	wait_next_clock();
+	bool serviced = false;
 
-	iorq = false;
-	m1 = false;
-	mreq = true;
-	rd = false;
-	wr = true;
-	rfsh = false;
+	if (take_event(EventBits::NMI)) {
+		nmi_acknowledge();
 
-	wait_next_clock();
+		serviced = true;
+	}
 
-	iorq = false;
-	m1 = false;
-	mreq = false;
-	rd = false;
-	wr = true;
-	rfsh = false;
+	if (iff1 && take_event(EventBits::INT)) {
+		int_acknowledge();
 
-	memory.write(address, value);
+		serviced = true;
+	}
+
+	return serviced;
 }
 
-uint8_t Soft80::read_io(uint8_t port_lo, uint8_t port_hi) {
-	wait_next_clock();
+Soft80::RunResult Soft80::step() {
+	// The executor already runs elsewhere and owns the state.
+	if (execution_mode != ExecutionMode::Synchronous) {
+		return { 0, StopReason::None };
+	}
 
-	update_m_cycle(M_Cycles::IORead);
+	size_t start = total_t_cycles;
 
-	address_bus = (static_cast<uint16_t>(port_hi) << 8) | port_lo;
+	bulk_deadline = start;
+	single_step = true;
 
-	iorq = false;
-	m1 = false;
-	mreq = false;
-	rd = false;
-	wr = false;
-	rfsh = false;
+	sync_fiber->resume();
 
-	wait_next_clock();
+	materialize_flags();
+
+	return { total_t_cycles - start, sync_stop };
+}
 
-	iorq = true;
-	m1 = false;
-	mreq = false;
-	rd = true;
-	wr = false;
-	rfsh = false;
+Soft80::RunResult Soft80::run_for(size_t t_cycles) {
+	// The executor already runs elsewhere and owns the state.
+	if (execution_mode != ExecutionMode::Synchronous) {
+		return { 0, StopReason::None };
+	}
 
-	wait_next_clock();
+	size_t start = total_t_cycles;
 
-	iorq = true;
-	m1 = false;
-	mreq = false;
-	rd = true;
-	wr = false;
-	rfsh = false;
+	bulk_deadline = start + t_cycles;
+	single_step = false;
 
-	wait_next_clock();
+	sync_fiber->resume();
 
-	iorq = true;
-	m1 = false;
-	mreq = false;
-	rd = true;
-	wr = false;
-	rfsh = false;
+	materialize_flags();
 
-	return devices.read(port_lo, port_hi);
+	return { total_t_cycles - start, sync_stop };
 }
 
-void Soft80::write_io(uint8_t port_lo, uint8_t port_hi, uint8_t value) {
-	wait_next_clock();
+// step() and run_for() run here, on a stack of their own, so that a run
+// held up by WAIT or BUSREQ can give control back in the middle of an
+// instruction.
+void Soft80::synchronous_executor() {
+	while (true) {
+		run_synchronous();
 
-	update_m_cycle(M_Cycles::IOWrite);
+		sync_fiber->suspend();
+	}
+}
 
-	address_bus = (static_cast<uint16_t>(port_hi) << 8) | port_lo;
-	data_bus = value;
+// A call that resumes a stall may have set a new deadline or asked for a
+// single step, so both are read afresh each time round.
+void Soft80::run_synchronous() {
+	while (single_step || total_t_cycles < bulk_deadline) {
+		bool skipped = false;
+		bool ran_blocks = false;
 
-	iorq = false;
-	m1 = false;
-	mreq = false;
-	rd = false;
-	wr = false;
-	rfsh = false;
+		if (!single_step) {
+			if (read_halt()) {
+				fast_forward_halt(bulk_deadline);
+			}
 
-	wait_next_clock();
+			// Only a taken branch can have just gone round a loop.
+			skipped = branch_taken && skip_idle_loop(bulk_deadline);
 
-	iorq = true;
-	m1 = false;
-	mreq = false;
-	rd = false;
-	wr = true;
-	rfsh = false;
+			ran_blocks = !skipped
+				&& execution_tier != ExecutionTier::Interpreter
+				&& can_enter_block()
+				&& run_blocks(bulk_deadline);
+		}
 
-	wait_next_clock();
+		if (!skipped && !ran_blocks) {
+			while (!executor_pass()) {}
+		}
 
-	iorq = true;
-	m1 = false;
-	mreq = false;
-	rd = false;
-	wr = true;
-	rfsh = false;
+		StopReason reason = stop_reason();
 
-	wait_next_clock();
+		if (single_step || reason != StopReason::None) {
+			sync_stop = reason;
 
-	iorq = true;
-	m1 = false;
-	mreq = false;
-	rd = false;
-	wr = true;
-	rfsh = false;
+			return;
+		}
+	}
 
-	devices.write(port_lo, port_hi, value);
+	sync_stop = StopReason::BudgetExhausted;
 }
 
-void Soft80::bus_acknowledge() {
-	wait_next_clock();
-
-	address_bus = 0;
-	data_bus = 0;
+// Once the budget is spent, a synchronous run waiting on an input returns
+// and carries on from the same T-state on the next call.
+void Soft80::stall(StopReason reason) {
+	if (execution_mode == ExecutionMode::Synchronous && total_t_cycles >= bulk_deadline) {
+		sync_stop = reason;
 
-	busack = true;
-
-	while (read_busreq()) {
-		wait_next_clock();
+		sync_fiber->suspend();
 	}
-
-	busack = false;
 }
 
-void Soft80::int_acknowledge() {
-	wait_next_clock();
+void Soft80::add_breakpoint(uint16_t address) {
+	breakpoints.set(address);
 
-	update_m_cycle(M_Cycles::IntAck);
+	block_cache.clear();
+}
 
-	halt = false;
+void Soft80::set_execution_tier(ExecutionTier tier) {
+	execution_tier = tier;
 
-	iff1 = false;
-	iff2 = false;
+	block_cache.clear();
+}
 
-	m1 = true;
+void Soft80::set_accuracy(Accuracy level) {
+	accuracy = level;
 
-	wait_next_clock();
-	wait_next_clock();
+	clock_debt = 0;
+}
 
-	iorq = true;
+void Soft80::set_history_depth(size_t depth) {
+	history_ring.assign(depth, HistoryEntry{});
+	history_ring.shrink_to_fit();
 
-	wait_next_clock();
-	wait_next_clock();
+	history_next = 0;
+	history_full = false;
+}
 
-	uint16_t vector = data_bus;
+std::vector<Soft80::HistoryEntry> Soft80::history() const {
+	std::vector<HistoryEntry> ret;
 
-	m1 = false;
-	iorq = false;
-	
-	switch (interrupt_mode) {
-	case 0:
-		int_response = true;
-		int_vector = vector;
-		break;
-	case 1:
-	{
-		uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
-		uint8_t PC_low = registers.PC & 0x00FF;
+	if (history_full) {
+		ret.insert(ret.end(), history_ring.begin() + history_next, history_ring.end());
+	}
 
-		registers.SP--;
-		write_memory(registers.SP, PC_high);
-		registers.SP--;
-		write_memory(registers.SP, PC_low);
+	ret.insert(ret.end(), history_ring.begin(), history_ring.begin() + history_next);
 
-		registers.PC = 0x0038;
+	return ret;
+}
 
-		break;
-	}
-	case 2:
-	{
+// One line per instruction, oldest first: the T-state it was fetched at,
+// its address and its bytes.
+void Soft80::dump_history(std::ostream& out) const {
+	std::ios_base::fmtflags flags = out.flags();
+	char fill = out.fill();
 
-		uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
-		uint8_t PC_low = registers.PC & 0x00FF;
+	for (const HistoryEntry& entry : history()) {
+		out << std::dec << std::setfill(' ') << std::setw(12) << entry.t_cycles << "  ";
+		out << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << entry.pc;
 
-		registers.SP--;
-		write_memory(registers.SP, PC_high);
-		registers.SP--;
-		write_memory(registers.SP, PC_low);
+		for (uint8_t i = 0; i < std::min<size_t>(entry.length, entry.bytes.size()); i++) {
+			out << ' ' << std::setw(2) << static_cast<int>(entry.bytes[i]);
+		}
 
-		uint16_t I = registers.I;
+		out << '\n';
+	}
 
-		uint16_t vector_low = (I << 8) | vector;
-		uint16_t vector_high = (I << 8) | (vector + 1);
+	out.flags(flags);
+	out.fill(fill);
+}
 
-		uint16_t addr_low = read_memory(vector_low);
-		uint16_t addr_high = read_memory(vector_high);
+void Soft80::record_history(uint16_t pc, uint8_t length, const std::array<uint8_t, 4>& bytes, size_t t_cycles) {
+	HistoryEntry& entry = history_ring[history_next];
 
-		registers.PC = (addr_high << 8) | addr_low;
+	entry.t_cycles = t_cycles;
+	entry.pc = pc;
+	entry.length = length;
+	entry.bytes = bytes;
 
-		break;
-	}
+	if (++history_next == history_ring.size()) {
+		history_next = 0;
+		history_full = true;
 	}
 }
 
-void Soft80::nmi_acknowledge() {
-	wait_next_clock();
-
-	update_m_cycle(M_Cycles::IntAck);
+void Soft80::add_static_blocks(const StaticBlock* blocks, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		static_blocks[blocks[i].start] = blocks[i];
+	}
 
-	halt = false;
+	block_cache.clear();
+}
 
-	iff2 = iff1;
-	iff1 = false;
+void Soft80::remove_breakpoint(uint16_t address) {
+	breakpoints.reset(address);
+}
 
-	uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
-	uint8_t PC_low = registers.PC & 0x00FF;
+Soft80::StopReason Soft80::stop_reason() {
+	if (read_halt()) {
+		return StopReason::Halted;
+	}
 
-	registers.SP--;
-	write_memory(registers.SP, PC_high);
-	registers.SP--;
-	write_memory(registers.SP, PC_low);
+	if (breakpoints.test(registers.PC)) {
+		return StopReason::Breakpoint;
+	}
 
-	registers.PC = 0x0066;
+	return StopReason::None;
 }
 
-void Soft80::execute_instruction() {
-
-	uint32_t operand1{ 0 };
-	uint32_t operand2{ 0 };
-	uint32_t result{ 0 };
+bool Soft80::can_enter_block() {
+	return !read_halt() && !int_response && decoder.is_idle() && !read_reset();
+}
 
-	uint16_t dest_value{ 0 };
-	uint16_t source_value{ 0 };
+bool Soft80::run_blocks(size_t deadline) {
+	block_cache.collect();
 
-	if (current_instruction->dest == RegisterFile::Names::Immediate) {
-		dest_value = current_instruction->imm;
-	}
-	else {
-		auto reg_val = registers.get_value(current_instruction->dest);
+	BasicBlock* block = find_block(registers.PC);
 
-		if (reg_val) {
-			dest_value = reg_val.value();
-		}
+	if (!block) {
+		return false;
 	}
 
-	if (current_instruction->source == RegisterFile::Names::Immediate) {
-		source_value = current_instruction->imm;
-	}
-	else {
-		auto reg_val = registers.get_value(current_instruction->source);
+	bool native = can_run_native();
 
-		if (reg_val) {
-			source_value = reg_val.value();
+	while (block) {
+		if (block->instructions.size() <= 2 && skip_idle_loop(deadline)) {
+			break;
 		}
-	}
-
-	if (current_instruction->addr_dest) {
-		operand1 = read_memory(dest_value + current_instruction->displacement);
-	}
-	else {
-		operand1 = dest_value;
-	}
-
-	if (current_instruction->addr_source) {
-		operand2 = read_memory(source_value + current_instruction->displacement);
-	}
-	else {
-		operand2 = source_value;
-	}
-
-	Flags flags = parse_flags(registers.main.F);
 
-	FlagNames out_flags = FlagNames::None;
+		if (native && !block->compiled) {
+			compile_block(block);
+		}
 
-	bool is_io = false;
+		if (native && block->native) {
+			active_block = block;
 
-	switch (current_instruction->name) {
+			materialize_flags();
 
-	case Instruction::Names::ADC:
-		result = operand1 + operand2;
+			block->native(*this);
 
-		if (flags.carry) {
-			result += 1;
+			if (sync_fiber->unwinding()) {
+				throw Fiber::Unwind{};
+			}
+		}
+		else {
+			execute_block(block);
 		}
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::ADD:
-		result = operand1 + operand2;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
+		if (service_interrupts() || read_halt() || total_t_cycles >= deadline
+			|| breakpoints.test(registers.PC) || read_reset()) {
+			break;
+		}
 
-	case Instruction::Names::AND:
-		result = operand1 & operand2;
+		BasicBlock* next = block->successor(registers.PC);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarrySet
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::CarryReset;
+		if (!next) {
+			next = find_block(registers.PC);
 
-		break;
+			if (next && block->valid) {
+				block->link(next);
+			}
+		}
 
-	case Instruction::Names::BIT:
-	{
-		uint32_t bit = 1 << operand1;
+		block = next;
+	}
 
-		bool is_set = bit & operand2;
+	return true;
+}
 
-		out_flags =
-			FlagNames::F5
-			| FlagNames::HalfCarrySet
-			| FlagNames::F3
-			| FlagNames::SubtractReset;
+void Soft80::execute_block(BasicBlock* block) {
+	const CachedInstruction* entries = block->instructions.data();
+	size_t count = block->instructions.size();
 
-		if (is_set) {
-			out_flags |= FlagNames::ZeroReset;
-			out_flags |= FlagNames::OverflowReset;
+	bool fuse = accuracy != Accuracy::BusCycle;
 
-			if (operand1 == 7) {
-				out_flags |= FlagNames::SignSet;
-			}
+	for (size_t i = 0; i < count; i++) {
+		if (fuse && entries[i].fused) {
+			execute_fused(entries + i, *block);
+			i++;
 		}
 		else {
-			out_flags |= FlagNames::ZeroSet;
-			out_flags |= FlagNames::OverflowSet;
+			execute_cached(entries[i]);
 		}
 
-		break;
+		if (!block->valid) {
+			return;
+		}
 	}
+}
 
-	case Instruction::Names::CALL:
-	{
-		bool take = true;
+void Soft80::execute_cached(const CachedInstruction& entry) {
+	load_cached(entry);
+	execute_instruction();
+}
 
-		switch (current_instruction->condition) {
-		case Instruction::Conditions::NZ:
-			take = !flags.zero;
-			break;
-		case Instruction::Conditions::Z:
-			take = flags.zero;
-			break;
-		case Instruction::Conditions::NC:
-			take = !flags.carry;
-			break;
-		case Instruction::Conditions::C:
-			take = flags.carry;
-			break;
-		case Instruction::Conditions::PO:
-			take = !flags.parity;
-			break;
-		case Instruction::Conditions::PE:
-			take = flags.parity;
-			break;
-		case Instruction::Conditions::P:
-			take = !flags.sign;
-			break;
-		case Instruction::Conditions::M:
-			take = flags.sign;
-			break;
-		}
+void Soft80::load_cached(const CachedInstruction& entry) {
+	if (!history_ring.empty()) {
+		record_history(registers.PC, entry.length, entry.bytes, total_t_cycles);
+	}
 
-		if (take) {
-			uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
-			uint8_t PC_low = registers.PC & 0x00FF;
+	for (uint8_t i = 0; i < entry.length; i++) {
+		fetch_cycle(false);
+	}
 
-			registers.SP--;
-			write_memory(registers.SP, PC_high);
-			registers.SP--;
-			write_memory(registers.SP, PC_low);
+	current_instruction = entry.instruction;
+	current_handler = entry.handler;
+	current_timing = entry.timing;
+}
 
-			registers.PC = dest_value;
-		}
+// Iterations after the first of a repeating block instruction can be run
+// together when nothing could tell them apart from running one at a time:
+// no pins or clock to drive, no interrupt or reset to take in between, no
+// breakpoint on the instruction, and its two bytes still there to be
+// fetched again. PC is still past the instruction.
+size_t Soft80::bulk_iterations(size_t remaining, uint8_t opcode) {
+	if (!can_run_native() || interrupt_pending() || read_reset()) {
+		return 0;
+	}
 
-		break;
+	uint16_t address = registers.PC - 2;
+
+	if (breakpoints.test(address) || memory.read(address) != 0xED
+		|| memory.read(static_cast<uint16_t>(address + 1)) != opcode) {
+		return 0;
 	}
 
-	case Instruction::Names::CCF:
+	// The first iteration is still to be charged at instruction accuracy.
+	size_t now = total_t_cycles;
 
-		out_flags = FlagNames::SubtractReset;
+	if (accuracy != Accuracy::BusCycle) {
+		now += current_timing.repeat;
+	}
 
-		if (flags.carry) {
-			out_flags |= FlagNames::CarryReset;
-			out_flags |= FlagNames::HalfCarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarrySet;
-			out_flags |= FlagNames::HalfCarryReset;
-		}
+	if (now >= bulk_deadline) {
+		return 0;
+	}
 
-		break;
+	size_t cost = Decoder::timing_of(current_instruction.value(), 2).repeat;
 
-	case Instruction::Names::CP:
-		result = operand2;
+	return std::min(remaining, (bulk_deadline - now + cost - 1) / cost);
+}
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractSet
-			| FlagNames::Carry;
+// Whether writing [low, high] would change the repeating block instruction
+// just executed before it is fetched again.
+bool Soft80::overwrites_instruction(uint16_t low, uint16_t high) {
+	uint16_t prefix_address = registers.PC - 2;
+	uint16_t opcode_address = registers.PC - 1;
 
-		break;
+	return (prefix_address >= low && prefix_address <= high)
+		|| (opcode_address >= low && opcode_address <= high);
+}
 
-	case Instruction::Names::CPD:
-	{
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-		uint8_t A = registers.main.A;
+// The table charge at instruction accuracy already covers one iteration at
+// base cost if the run has finished.
+void Soft80::charge_bulk_iterations(size_t count, bool finished) {
+	DecodeEntry::Timing timing = Decoder::timing_of(current_instruction.value(), 2);
 
-		uint8_t val = read_memory(HL);
+	size_t t_cycles = count * timing.repeat;
 
-		uint8_t res = A - val;
+	if (finished && accuracy == Accuracy::BusCycle) {
+		t_cycles = t_cycles - timing.repeat + timing.base;
+	}
 
-		registers.main.HL = HL - 1;
-		registers.main.BC = BC - 1;
+	charge_t_cycles(t_cycles);
+}
 
-		bool is_neg = res & 0x80;
-		bool halfc = (A & 0x10) && (val & 0x10);
+// A loop that only counts a register down, going round until it reaches
+// zero, can be stepped over by counting its iterations. The forms are DJNZ
+// to itself, DEC r then JP NZ back to it, and DEC r then JR back to it. JP
+// writes to its target, so that has to be in ROM. JR takes no notice of its
+// condition in this core, so that loop only ends with an interrupt.
+bool Soft80::skip_idle_loop(size_t deadline) {
+	if (!can_enter_block() || !can_run_native() || interrupt_pending() || total_t_cycles >= deadline) {
+		return false;
+	}
 
-		out_flags =
-			FlagNames::SubtractSet;
+	uint16_t start = registers.PC;
 
-		if (is_neg) {
-			out_flags |= FlagNames::SignSet;
-		}
-		else {
-			out_flags |= FlagNames::SignReset;
-		}
+	const CachedInstruction* first = instruction_cache.lookup(start);
 
-		if (res == 0) {
-			out_flags |= FlagNames::ZeroSet;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
-		}
+	if (!first || breakpoints.test(start)) {
+		return false;
+	}
+
+	RegisterFile::Names counter = RegisterFile::Names::B;
+
+	const CachedInstruction* branch = first;
+	uint16_t branch_address = start;
 
-		if (halfc) {
-			out_flags |= FlagNames::HalfCarrySet;
+	if (first->instruction.name != Instruction::Names::DJNZ) {
+		OperandKind kind = operand_kind(first->instruction.dest, first->instruction.addr_dest);
+
+		counter = first->instruction.dest;
+
+		if (first->instruction.name != Instruction::Names::DEC
+			|| (kind != OperandKind::Register && kind != OperandKind::Pair)
+			|| counter == RegisterFile::Names::F || counter == RegisterFile::Names::AF) {
+			return false;
 		}
-		else {
-			out_flags |= FlagNames::HalfCarryReset;
+
+		branch_address = start + first->length;
+		branch = instruction_cache.lookup(branch_address);
+
+		if (!branch || breakpoints.test(branch_address)) {
+			return false;
 		}
+	}
+
+	const Instruction& jump = branch->instruction;
+
+	uint16_t exit = branch_address + branch->length;
+	uint16_t target = exit + jump.displacement;
 
-		if (registers.main.BC == 0) {
-			out_flags |= FlagNames::OverflowReset;
+	bool finite = true;
+
+	switch (jump.name) {
+	case Instruction::Names::DJNZ:
+		// DJNZ counts B, so a DEC in front would be a second counter.
+		if (branch != first || target != start) {
+			return false;
 		}
-		else {
-			out_flags |= FlagNames::OverflowSet;
+		break;
+	case Instruction::Names::JR:
+		if (branch == first || target != start) {
+			return false;
 		}
 
+		finite = false;
 		break;
-	}
-
-	case Instruction::Names::CPDR:
+	case Instruction::Names::JP:
 	{
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-		uint8_t A = registers.main.A;
+		const MemoryMap::Mapping* mapping = memory.find_mapping(start);
+		size_t length = 1;
 
-		uint8_t val = read_memory(HL);
+		if (branch == first || jump.condition != Instruction::Conditions::NZ
+			|| jump.dest != RegisterFile::Names::Immediate || !jump.addr_dest || jump.imm != start
+			|| !mapping || mapping->is_mutable || !memory.direct_run(start, 1, length, false)) {
+			return false;
+		}
+		break;
+	}
+	default:
+		return false;
+	}
 
-		uint8_t res = A - val;
+	size_t body = branch == first ? 0 : first->timing.base;
+	size_t taken = body + branch->timing.taken;
+	size_t last = body + branch->timing.base;
 
-		registers.main.HL = HL - 1;
-		registers.main.BC = BC - 1;
+	uint16_t value = registers.get_value(counter).value_or(0);
+	size_t period = RegisterFile::is_16bit(counter) ? 0x10000 : 0x100;
 
-		bool is_neg = res & 0x80;
-		bool halfc = (A & 0x10) && (val & 0x10);
+	size_t remaining = !finite ? SIZE_MAX : value == 0 ? period : value;
 
-		out_flags =
-			FlagNames::SubtractSet;
+	// Only whole iterations that end by the deadline, so a run still stops
+	// on the same instruction as it would without skipping.
+	size_t count = std::min(remaining, (deadline - total_t_cycles) / taken);
 
-		bool should_repeat = true;
+	if (count == 0) {
+		return false;
+	}
 
-		if (is_neg) {
-			out_flags |= FlagNames::SignSet;
-		}
-		else {
-			out_flags |= FlagNames::SignReset;
-		}
+	bool exits = count == remaining;
 
-		if (res == 0) {
-			out_flags |= FlagNames::ZeroSet;
+	registers.set_value(counter, static_cast<uint16_t>(value - count));
+	registers.PC = exits ? exit : start;
 
-			should_repeat = false;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
-		}
+	set_flags(0);
 
-		if (halfc) {
-			out_flags |= FlagNames::HalfCarrySet;
+	// The bus is left as the end of the branch would leave it: the write
+	// to the target for JP, and a fetch otherwise.
+	if (accuracy == Accuracy::BusCycle) {
+		if (jump.name == Instruction::Names::JP) {
+			current_m_cycle = M_Cycles::MemWrite;
+			address_bus = start;
+			data_bus = 0;
+			set_bus_pins(PinBits::WR);
 		}
 		else {
-			out_flags |= FlagNames::HalfCarryReset;
+			current_m_cycle = M_Cycles::OpcodeFetch;
+			set_bus_pins(PinBits::MREQ | PinBits::RFSH);
 		}
+	}
 
-		if (registers.main.BC == 0) {
-			out_flags |= FlagNames::OverflowReset;
+	charge_t_cycles(exits ? (count - 1) * taken + last : count * taken);
 
-			should_repeat = false;
-		}
-		else {
-			out_flags |= FlagNames::OverflowSet;
-		}
+	return true;
+}
 
-		if (should_repeat) {
-			registers.PC = registers.PC - 2;
-		}
+// Native code charges T-states per instruction without driving the pins
+// or sampling WAIT and BUSREQ, so it only runs while neither is asserted.
+bool Soft80::can_run_native() {
+	return execution_mode == ExecutionMode::Synchronous
+		&& !(pending_events.load(std::memory_order_acquire) & (EventBits::WAIT | EventBits::BUSREQ));
+}
 
-		break;
-	}
+void Soft80::compile_block(BasicBlock* block) {
+	block->compiled = true;
+	block->native = find_static_code(block);
 
-	case Instruction::Names::CPI:
-	{
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-		uint8_t A = registers.main.A;
+	if (block->native || execution_tier != ExecutionTier::Recompiler || !Recompiler::is_supported()) {
+		return;
+	}
 
-		uint8_t val = read_memory(HL);
+	block->native = recompiler.compile(*block);
 
-		uint8_t res = A - val;
+	if (!block->native) {
+		recompiler.reset();
+		block_cache.drop_native_code();
 
-		registers.main.HL = HL + 1;
-		registers.main.BC = BC - 1;
+		block->compiled = true;
+		block->native = recompiler.compile(*block);
+	}
+}
 
-		bool is_neg = res & 0x80;
-		bool halfc = (A & 0x10) && (val & 0x10);
+BasicBlock::NativeCode Soft80::find_static_code(const BasicBlock* block) {
+	auto it = static_blocks.find(block->start);
 
-		out_flags =
-			FlagNames::SubtractSet;
+	if (it == static_blocks.end() || it->second.end != block->end) {
+		return nullptr;
+	}
 
-		if (is_neg) {
-			out_flags |= FlagNames::SignSet;
-		}
-		else {
-			out_flags |= FlagNames::SignReset;
-		}
+	uint16_t length = block->end - block->start;
 
-		if (res == 0) {
-			out_flags |= FlagNames::ZeroSet;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
+	for (uint16_t i = 0; i < length; i++) {
+		if (memory.read(block->start + i) != it->second.bytes[i]) {
+			return nullptr;
 		}
+	}
 
-		if (halfc) {
-			out_flags |= FlagNames::HalfCarrySet;
-		}
-		else {
-			out_flags |= FlagNames::HalfCarryReset;
-		}
+	return it->second.code;
+}
 
-		if (registers.main.BC == 0) {
-			out_flags |= FlagNames::OverflowReset;
-		}
-		else {
-			out_flags |= FlagNames::OverflowSet;
-		}
+BasicBlock* Soft80::find_block(uint16_t address) {
+	BasicBlock* block = block_cache.lookup(address);
 
-		break;
+	if (!block) {
+		block = build_block(address);
 	}
 
-	case Instruction::Names::CPIR:
-	{
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-		uint8_t A = registers.main.A;
+	return block;
+}
 
-		uint8_t val = read_memory(HL);
+BasicBlock* Soft80::build_block(uint16_t address) {
+	auto block = std::make_unique<BasicBlock>();
 
-		uint8_t res = A - val;
+	block->start = address;
 
-		registers.main.HL = HL + 1;
-		registers.main.BC = BC - 1;
+	uint16_t pc = address;
 
-		bool is_neg = res & 0x80;
-		bool halfc = (A & 0x10) && (val & 0x10);
+	while (block->instructions.size() < BlockCache::MaxInstructions) {
+		if (pc != address && breakpoints.test(pc)) {
+			break;
+		}
 
-		out_flags =
-			FlagNames::SubtractSet;
+		const CachedInstruction* cached = instruction_cache.lookup(pc);
 
-		bool should_repeat = true;
+		CachedInstruction entry;
 
-		if (is_neg) {
-			out_flags |= FlagNames::SignSet;
+		if (cached) {
+			entry = *cached;
 		}
 		else {
-			out_flags |= FlagNames::SignReset;
-		}
+			std::optional<Instruction> decoded;
 
-		if (res == 0) {
-			out_flags |= FlagNames::ZeroSet;
+			do {
+				entry.bytes[entry.length] = memory.read(pc + entry.length);
+				decoded = block_decoder.decode(entry.bytes[entry.length]);
+				entry.length++;
+			} while (!decoded);
 
-			should_repeat = false;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
-		}
+			if (!block_decoder.is_idle()) {
+				block_decoder = Decoder{};
 
-		if (halfc) {
-			out_flags |= FlagNames::HalfCarrySet;
-		}
-		else {
-			out_flags |= FlagNames::HalfCarryReset;
-		}
+				break;
+			}
 
-		if (registers.main.BC == 0) {
-			out_flags |= FlagNames::OverflowReset;
+			entry.instruction = decoded.value();
+			entry.handler = bind_handler(entry.instruction);
+			entry.timing = block_decoder.timing();
 
-			should_repeat = false;
-		}
-		else {
-			out_flags |= FlagNames::OverflowSet;
+			instruction_cache.insert(pc, entry);
 		}
 
-		if (should_repeat) {
-			registers.PC = registers.PC - 2;
-		}
+		block->instructions.push_back(entry);
 
-		break;
+		pc += entry.length;
+
+		if (BasicBlock::is_terminator(entry.instruction)) {
+			break;
+		}
 	}
 
-	case Instruction::Names::CPL:
+	if (block->instructions.empty()) {
+		return nullptr;
+	}
 
-		result = ~operand1;
+	block->end = pc;
 
-		out_flags =
-			FlagNames::HalfCarrySet
-			| FlagNames::SubtractSet;
+	fuse_block(block.get());
 
-		break;
+	return block_cache.insert(std::move(block));
+}
 
-	case Instruction::Names::DAA:
-	{
-		uint8_t upper = static_cast<uint8_t>(operand1 & 0x000000F0) >> 4;
-		uint8_t lower = static_cast<uint8_t>(operand1 & 0x0000000F);
+// Pairs up entries that have a superinstruction, first come first served.
+void Soft80::fuse_block(BasicBlock* block) {
+	auto& entries = block->instructions;
 
-		result = operand1;
+	for (size_t i = 0; i + 1 < entries.size(); i++) {
+		entries[i].fused = bind_fused(entries[i].handler, entries[i + 1].handler);
 
-		if (lower > 0x09 || flags.half_carry) {
-			result += 0x06;
+		if (entries[i].fused) {
+			i++;
 		}
+	}
+}
 
-		if (upper > 0x09 || flags.carry) {
-			result += 0x60;
-		}
+void Soft80::wait_next_clock() {
+	if (accuracy != Accuracy::BusCycle) {
+		charge_t_cycles(1);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::Carry;
+		return;
+	}
 
-		break;
+	if (execution_mode == ExecutionMode::Synchronous) {
+		do {
+			total_t_cycles++;
+			current_t_cycles++;
+
+			if (read_wait()) {
+				stall(StopReason::Waiting);
+			}
+		} while (read_wait());
+
+		return;
 	}
 
-	case Instruction::Names::DEC:
+	do {
+		take_clock(1);
+	} while (read_wait());
+}
 
-		result = operand1 - 1;
+// Uses up to t_cycles of the clock credit, waiting until there is some.
+// Only the executor takes credit, so what it sees stays there, and only it
+// counts the T-states, as it uses them.
+size_t Soft80::take_clock(size_t t_cycles) {
+	size_t credit = clock_credit.load(std::memory_order_acquire);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractSet;
+	while (credit == 0) {
+		wait_for_clock();
 
-		break;
+		credit = clock_credit.load(std::memory_order_acquire);
+	}
 
-	case Instruction::Names::DI:
-		iff1 = false;
-		iff2 = false;
-		break;
+	size_t taken = std::min(credit, t_cycles);
 
-	case Instruction::Names::DJNZ:
+	clock_credit.fetch_sub(taken, std::memory_order_acq_rel);
 
-		registers.main.B = registers.main.B - 1;
+	total_t_cycles += taken;
+	current_t_cycles += taken;
 
-		if (registers.main.B != 0) {
-			registers.PC = registers.PC + current_instruction->displacement;
-		}
+	return taken;
+}
 
-		break;
+// A fiber gives the thread back until the next cycle_clock(); a thread
+// spins or sleeps on the credit.
+void Soft80::wait_for_clock() {
+	if (fiber) {
+		fiber->suspend();
 
-	case Instruction::Names::EI:
-		iff1 = true;
-		iff2 = true;
-		break;
+		return;
+	}
 
-	case Instruction::Names::EX:
+	if (should_executor_exit) {
+		exit(0);
+	}
 
-		registers.set_value(current_instruction->source, operand1);
-		result = operand2;
+	if (clock_wait == ClockWait::Block) {
+		clock_credit.wait(0, std::memory_order_acquire);
+	}
+	else {
+		std::this_thread::yield();
+	}
+}
 
-		break;
+void Soft80::charge_t_cycles(size_t t_cycles) {
+	if (execution_mode == ExecutionMode::Synchronous) {
+		total_t_cycles += t_cycles;
+		current_t_cycles += t_cycles;
+	}
+	else {
+		clock_debt += t_cycles;
+	}
+}
 
-	case Instruction::Names::EXX:
+void Soft80::catch_up_clock() {
+	while (clock_debt > 0) {
+		clock_debt -= take_clock(clock_debt);
+	}
+}
 
-		std::swap(registers.main.BC, registers.alt.BC);
-		std::swap(registers.main.DE, registers.alt.DE);
-		std::swap(registers.main.HL, registers.alt.HL);
+void Soft80::fetch_opcode() {
+	if (decoder.is_idle() && !int_response) {
+		const CachedInstruction* cached = instruction_cache.lookup(registers.PC);
 
-		break;
+		if (cached) {
+			load_cached(*cached);
 
-	case Instruction::Names::HALT:
+			return;
+		}
 
-		halt = true;
+		fetch_start = registers.PC;
+		fetch_stamp = total_t_cycles;
+		fetch_cacheable = true;
+	}
 
-		break;
+	uint16_t offset = registers.PC - fetch_start;
 
-	case Instruction::Names::IM:
+	uint8_t byte = fetch_cycle(true);
 
-		if (current_instruction->imm == 0) {
-			interrupt_mode = 0;
-		}
-		else if (current_instruction->imm == 2) {
-			interrupt_mode = 1;
-		}
-		else if (current_instruction->imm == 3) {
-			interrupt_mode = 2;
-		}
+	if (fetch_cacheable && offset < fetch_bytes.size()) {
+		fetch_bytes[offset] = byte;
+	}
 
-		break;
+	current_instruction = decoder.decode(byte);
 
-	case Instruction::Names::IN:
-	{
+	if (current_instruction) {
+		current_handler = bind_handler(current_instruction.value());
+		current_timing = decoder.timing();
 
-		uint8_t low = registers.main.C;
-		uint8_t high = registers.main.B;
+		if (fetch_cacheable && !int_response && decoder.is_idle()) {
+			uint8_t length = static_cast<uint16_t>(registers.PC - fetch_start);
 
-		if (current_instruction->source == RegisterFile::Names::Immediate) {
-			low = current_instruction->imm_low;
-			high = registers.main.A;
+			instruction_cache.insert(fetch_start, { current_instruction.value(), length, current_handler, current_timing, fetch_bytes });
 		}
 
-		result = read_io(low, high);
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
+		if (!history_ring.empty()) {
+			if (fetch_cacheable) {
+				record_history(fetch_start, static_cast<uint8_t>(registers.PC - fetch_start), fetch_bytes, fetch_stamp);
+			}
+			else {
+				record_history(registers.PC, 0, {}, total_t_cycles);
+			}
+		}
 
-		break;
+		fetch_cacheable = false;
 	}
+}
 
-	case Instruction::Names::INC:
-		result = operand1 + 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractReset;
+uint8_t Soft80::fetch_cycle(bool read) {
+	if (accuracy != Accuracy::BusCycle) {
+		return fetch_untimed(read);
+	}
 
-		break;
+	wait_next_clock();
 
-	case Instruction::Names::IND:
-	{
-		is_io = true;
+	if (!int_response) {
+		update_m_cycle(M_Cycles::OpcodeFetch);
+	}
 
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
+	uint8_t read_byte = 0;
 
-		uint8_t val = read_io(C, B);
+	if (int_vector) {
+		read_byte = int_vector.value();
+		int_vector = std::nullopt;
+	}
+	else {
+		set_bus_pins(PinBits::M1 | PinBits::MREQ | PinBits::RD);
 
-		write_memory(HL, val);
+		wait_next_clock();
 
-		registers.main.B = B - 1;
-		registers.main.HL = HL - 1;
+		set_bus_pins(PinBits::M1 | PinBits::MREQ | PinBits::RD);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
+		if (read) {
+			read_byte = memory.read(registers.PC);
+		}
 
-		if (registers.main.B == 0) {
-			out_flags |= FlagNames::ZeroSet;
+		if (int_response) {
+			read_byte = data_bus;
 		}
 		else {
-			out_flags |= FlagNames::ZeroReset;
+			registers.PC++;
 		}
 
-		break;
-	}
+		wait_next_clock();
 
-	case Instruction::Names::INDR:
-	{
-		is_io = true;
+		set_bus_pins(PinBits::MREQ | PinBits::RFSH);
 
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
+		wait_next_clock();
 
-		uint8_t val = read_io(C, B);
+		set_bus_pins(PinBits::MREQ | PinBits::RFSH);
+	}
 
-		write_memory(HL, val);
+	return read_byte;
+}
 
-		registers.main.B = B - 1;
-		registers.main.HL = HL - 1;
+uint8_t Soft80::fetch_untimed(bool read) {
+	uint8_t read_byte = 0;
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::ZeroSet
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
+	if (int_vector) {
+		read_byte = int_vector.value();
+		int_vector = std::nullopt;
 
-		if (registers.main.B != 0) {
-			registers.PC = registers.PC - 2;
+		vector_fetch = true;
+	}
+	else {
+		if (read) {
+			read_byte = memory.read(registers.PC);
 		}
 
-		break;
+		if (int_response) {
+			read_byte = data_bus;
+		}
+		else {
+			registers.PC++;
+		}
 	}
 
-	case Instruction::Names::INI:
-	{
-		is_io = true;
+	return read_byte;
+}
 
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
+uint8_t Soft80::read_memory(uint16_t address) {
+	if (accuracy != Accuracy::BusCycle) {
+		return memory.read(address);
+	}
 
-		uint8_t val = read_io(C, B);
+	wait_next_clock();
 
-		write_memory(HL, val);
+	update_m_cycle(M_Cycles::MemRead);
 
-		registers.main.B = B - 1;
-		registers.main.HL = HL + 1;
+	address_bus = address;
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
+	set_bus_pins(PinBits::MREQ | PinBits::RD);
 
-		if (registers.main.B == 0) {
-			out_flags |= FlagNames::ZeroSet;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
-		}
+	wait_next_clock();
 
-		break;
-	}
+	set_bus_pins(PinBits::MREQ | PinBits::RD);
 
-	case Instruction::Names::INIR:
-	{
-		is_io = true;
+	wait_next_clock();
 
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
+	set_bus_pins(PinBits::RD);
 
-		uint8_t val = read_io(C, B);
+	return memory.read(address);
+}
 
-		write_memory(HL, val);
+void Soft80::write_memory(uint16_t address, uint8_t value) {
+	if (accuracy != Accuracy::BusCycle) {
+		memory.write(address, value);
 
-		registers.main.B = B - 1;
-		registers.main.HL = HL + 1;
+		return;
+	}
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::ZeroSet
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
+	wait_next_clock();
 
-		if (registers.main.B != 0) {
-			registers.PC = registers.PC - 2;
-		}
+	update_m_cycle(M_Cycles::MemWrite);
 
-		break;
-	}
+	address_bus = address;
+	data_bus = value;
 
-	case Instruction::Names::JP:
-	{
-		bool take = true;
+	set_bus_pins(PinBits::MREQ);
 
-		switch (current_instruction->condition) {
-		case Instruction::Conditions::NZ:
-			take = !flags.zero;
-			break;
-		case Instruction::Conditions::Z:
-			take = flags.zero;
-			break;
-		case Instruction::Conditions::NC:
-			take = !flags.carry;
-			break;
-		case Instruction::Conditions::C:
-			take = flags.carry;
-			break;
-		case Instruction::Conditions::PO:
-			take = !flags.parity;
-			break;
-		case Instruction::Conditions::PE:
-			take = flags.parity;
-			break;
-		case Instruction::Conditions::P:
-			take = !flags.sign;
-			break;
-		case Instruction::Conditions::M:
-			take = flags.sign;
-			break;
-		}
-
-		if (take) {
-			registers.PC = dest_value;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::JR:
-
-		registers.PC = registers.PC + current_instruction->displacement;
-
-		break;
-
-	case Instruction::Names::LD:
-
-		if (current_instruction->dest == RegisterFile::Names::A
-			&& (current_instruction->source == RegisterFile::Names::I
-				|| current_instruction->source == RegisterFile::Names::R)) {
-
-			out_flags =
-				FlagNames::Sign
-				| FlagNames::Zero
-				| FlagNames::F5
-				| FlagNames::HalfCarryReset
-				| FlagNames::F3
-				| FlagNames::Parity
-				| FlagNames::SubtractReset;
-
-			if (iff2) {
-				out_flags |= FlagNames::OverflowSet;
-			}
-			else {
-				out_flags |= FlagNames::OverflowReset;
-			}
-		}
-
-		result = operand2;
-
-		break;
-
-	case Instruction::Names::LDD:
-	{
-		uint16_t DE = registers.main.DE;
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-
-		uint8_t val = read_memory(HL);
-		write_memory(DE, val);
-
-		registers.main.DE = DE - 1;
-		registers.main.HL = HL - 1;
-		registers.main.BC = BC - 1;
-
-		out_flags =
-			FlagNames::HalfCarryReset
-			| FlagNames::SubtractReset;
-
-		if (registers.main.BC == 0) {
-			out_flags |= FlagNames::OverflowReset;
-		}
-		else {
-			out_flags |= FlagNames::OverflowSet;
-		}
-
-		break;
-	}
-		
-	case Instruction::Names::LDDR:
-	{
-		uint16_t DE = registers.main.DE;
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-
-		uint8_t val = read_memory(HL);
-		write_memory(DE, val);
-
-		registers.main.DE = DE - 1;
-		registers.main.HL = HL - 1;
-		registers.main.BC = BC - 1;
-
-		out_flags =
-			FlagNames::HalfCarryReset
-			| FlagNames::OverflowReset
-			| FlagNames::SubtractReset;
-
-		if (registers.main.BC != 0) {
-			registers.PC = registers.PC - 2;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::LDI:
-	{
-		uint16_t DE = registers.main.DE;
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-
-		uint8_t val = read_memory(HL);
-		write_memory(DE, val);
-
-		registers.main.DE = DE + 1;
-		registers.main.HL = HL + 1;
-		registers.main.BC = BC - 1;
-
-		out_flags =
-			FlagNames::HalfCarryReset
-			| FlagNames::SubtractReset;
-
-		if (registers.main.BC == 0) {
-			out_flags |= FlagNames::OverflowReset;
-		}
-		else {
-			out_flags |= FlagNames::OverflowSet;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::LDIR:
-	{
-		uint16_t DE = registers.main.DE;
-		uint16_t HL = registers.main.HL;
-		uint16_t BC = registers.main.BC;
-
-		uint8_t val = read_memory(HL);
-		write_memory(DE, val);
-
-		registers.main.DE = DE + 1;
-		registers.main.HL = HL + 1;
-		registers.main.BC = BC - 1;
-
-		out_flags =
-			FlagNames::HalfCarryReset
-			| FlagNames::OverflowReset
-			| FlagNames::SubtractReset;
-
-		if (registers.main.BC != 0) {
-			registers.PC = registers.PC - 2;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::NEG:
-
-		result = -operand1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractSet
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::NOP:
-	
-		break;
-
-	case Instruction::Names::OR:
-		result = operand1 | operand2;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::CarryReset;
-
-		break;
-
-	case Instruction::Names::OTDR:
-	{
-		is_io = true;
-
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
-
-		uint8_t val = read_memory(HL);
-
-		write_io(C, B, val);
-
-		registers.main.B = B - 1;
-		registers.main.HL = HL - 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::ZeroSet
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
-
-		if (registers.main.B != 0) {
-			registers.PC = registers.PC - 2;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::OTIR:
-	{
-		is_io = true;
-
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
-
-		uint8_t val = read_memory(HL);
-
-		write_io(C, B, val);
-
-		registers.main.B = B - 1;
-		registers.main.HL = HL + 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::ZeroSet
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
-
-		if (registers.main.B != 0) {
-			registers.PC = registers.PC - 2;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::OUT:
-	{
-		is_io = true;
-
-		uint8_t low = registers.main.C;
-		uint8_t high = registers.main.B;
-
-		if (current_instruction->dest == RegisterFile::Names::Immediate) {
-			low = current_instruction->imm_low;
-			high = registers.main.A;
-		}
-
-		write_io(low, high, operand2);
-
-		break;
-	}
-
-	case Instruction::Names::OUTD:
-	{
-		is_io = true;
-
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
-
-		uint8_t val = read_memory(HL);
-
-		write_io(C, B, val);
-
-		registers.main.B = B - 1;
-		registers.main.HL = HL - 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
-
-		if (registers.main.B == 0) {
-			out_flags |= FlagNames::ZeroSet;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::OUTI:
-	{
-		is_io = true;
-
-		uint8_t C = registers.main.C;
-		uint8_t B = registers.main.B;
-		uint16_t HL = registers.main.HL;
-
-		uint8_t val = read_memory(HL);
-
-		write_io(C, B, val);
-
-		registers.main.B = B - 1;
-		registers.main.HL = HL + 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::F5
-			| FlagNames::F3
-			| FlagNames::SubtractSet;
-
-		if (registers.main.B == 0) {
-			out_flags |= FlagNames::ZeroSet;
-		}
-		else {
-			out_flags |= FlagNames::ZeroReset;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::POP:
-	{
-		uint16_t low = read_memory(registers.SP);
-		registers.SP++;
-		uint16_t high = read_memory(registers.SP);
-		registers.SP++;
-
-		result = low | (high << 8);
-
-		break;
-	}
-
-	case Instruction::Names::PUSH:
-	{
-		uint8_t low = operand2 & 0x000000FF;
-		uint8_t high = (operand2 & 0x0000FF00) >> 8;
-
-		registers.SP--;
-		write_memory(registers.SP, high);
-		registers.SP--;
-		write_memory(registers.SP, low);
-
-		break;
-	}
-
-	case Instruction::Names::RES:
-	{
-		uint8_t bit = 1 << operand1;
-		uint8_t value = (operand2 | bit) ^ bit;
-
-		if (current_instruction->addr_source) {
-			write_memory(source_value, value);
-		}
-		else {
-			registers.set_value(current_instruction->source, value);
-		}
-
-		break;
-	}
-
-	case Instruction::Names::RET:
-	{
-		bool take = true;
-
-		switch (current_instruction->condition) {
-		case Instruction::Conditions::NZ:
-			take = !flags.zero;
-			break;
-		case Instruction::Conditions::Z:
-			take = flags.zero;
-			break;
-		case Instruction::Conditions::NC:
-			take = !flags.carry;
-			break;
-		case Instruction::Conditions::C:
-			take = flags.carry;
-			break;
-		case Instruction::Conditions::PO:
-			take = !flags.parity;
-			break;
-		case Instruction::Conditions::PE:
-			take = flags.parity;
-			break;
-		case Instruction::Conditions::P:
-			take = !flags.sign;
-			break;
-		case Instruction::Conditions::M:
-			take = flags.sign;
-			break;
-		}
-
-		if (take) {
-			uint16_t low = read_memory(registers.SP);
-			registers.SP++;
-			uint16_t high = read_memory(registers.SP);
-			registers.SP++;
-
-			uint16_t addr = low | (high << 8);
-
-			registers.PC = addr;
-		}
-
-		break;
-	}
-
-	case Instruction::Names::RETI:
-	{
-		uint16_t low = read_memory(registers.SP);
-		registers.SP++;
-		uint16_t high = read_memory(registers.SP);
-		registers.SP++;
-
-		uint16_t addr = low | (high << 8);
-
-		registers.PC = addr;
-
-		break;
-	}
-
-	case Instruction::Names::RETN:
-	{
-		uint16_t low = read_memory(registers.SP);
-		registers.SP++;
-		uint16_t high = read_memory(registers.SP);
-		registers.SP++;
-
-		uint16_t addr = low | (high << 8);
-
-		registers.PC = addr;
-
-		iff1 = iff2;
-
-		break;
-	}
-
-	case Instruction::Names::RL:
-
-		result = operand1 << 1;
-
-		if (flags.carry) {
-			result |= 1;
-		}
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::RLA:
-
-		result = operand1 << 1;
-
-		out_flags =
-			FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::RLC:
-		
-		result = operand1 << 1;
-
-		if (operand1 & 0xFFFFFF00) {
-			result |= 1;
-		}
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::RLCA:
-
-		result = operand1 << 1;
-
-		if (operand1 & 0xFFFFFF00) {
-			result |= 1;
-		}
-
-		out_flags =
-			FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::RLD:
-	{
-		uint16_t A = 0x000F & registers.main.A;
-		uint16_t HL = read_memory(registers.main.HL);
-
-		operand1 = (A << 8) | HL;
-
-		result = operand1 << 4;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		break;
-	}
-
-	case Instruction::Names::RR:
-
-		result = operand1 >> 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand1 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
-
-		break;
-
-	case Instruction::Names::RRA:
-
-		result = operand1 >> 1;
-
-		out_flags =
-			FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::SubtractReset;
-
-		if (operand1 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
-
-		break;
-
-	case Instruction::Names::RRC:
-
-		result = operand1 >> 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand1 & 1) {
-			result |= 0x80;
-
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
-
-		break;
-
-	case Instruction::Names::RRCA:
-
-		result = operand1 >> 1;
-
-		out_flags =
-			FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::SubtractReset;
-
-		if (operand1 & 1) {
-			result |= 0x80;
-
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
-
-		break;
-
-	case Instruction::Names::RRD:
-	{
-		uint16_t A = 0x000F & registers.main.A;
-		uint16_t HL = read_memory(registers.main.HL);
-
-		operand1 = (A << 8) | HL;
-
-		result = operand1 >> 4;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		break;
-	}
-
-	case Instruction::Names::RST:
-	{
-		uint8_t low = registers.PC & 0x00FF;
-		uint8_t high = (registers.PC & 0xFF00) >> 8;
-
-		registers.SP--;
-		write_memory(registers.SP, high);
-		registers.SP--;
-		write_memory(registers.SP, low);
-
-		registers.PC = current_instruction->imm;
-
-		break;
-	}
-
-	case Instruction::Names::SBC:
-
-		result = operand1 - operand2;
-
-		if (flags.carry) {
-			result -= 1;
-		}
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractSet
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::SCF:
+	wait_next_clock();
 
-		out_flags =
-			FlagNames::SubtractReset
-			| FlagNames::CarrySet
-			| FlagNames::HalfCarryReset;
+	set_bus_pins(PinBits::MREQ | PinBits::WR);
 
-		break;
+	wait_next_clock();
 
-	case Instruction::Names::SET:
-	{
-		uint8_t bit = 1 << operand1;
-		uint8_t value = operand2 | bit;
+	set_bus_pins(PinBits::WR);
 
-		if (current_instruction->addr_source) {
-			write_memory(source_value, value);
-		}
-		else {
-			registers.set_value(current_instruction->source, value);
-		}
+	memory.write(address, value);
+}
 
-		break;
+uint8_t Soft80::read_io(uint8_t port_lo, uint8_t port_hi) {
+	if (accuracy != Accuracy::BusCycle) {
+		return devices.read(port_lo, port_hi);
 	}
 
-	case Instruction::Names::SLA:
-
-		result = operand1 << 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
-
-		break;
-
-	case Instruction::Names::SRA:
+	wait_next_clock();
 
-		if (operand1 & 0xFFFFFF80) {
-			result = (operand1 | 0xFFFFFF00) >> 1;
-		}
-		else {
-			result = operand1 >> 1;
-		}
+	update_m_cycle(M_Cycles::IORead);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand1 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
+	address_bus = (static_cast<uint16_t>(port_hi) << 8) | port_lo;
 
-		break;
+	set_bus_pins(0);
 
-	case Instruction::Names::SLL:
+	wait_next_clock();
 
-		result = operand1 << 1;
+	set_bus_pins(PinBits::IORQ | PinBits::RD);
 
-		result |= 1;
+	wait_next_clock();
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
+	set_bus_pins(PinBits::IORQ | PinBits::RD);
 
-		break;
+	wait_next_clock();
 
-	case Instruction::Names::SRL:
-	
-		result = operand1 >> 1;
-	
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand1 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
+	set_bus_pins(PinBits::IORQ | PinBits::RD);
 
-		break;
+	return devices.read(port_lo, port_hi);
+}
 
-	case Instruction::Names::SUB:
+void Soft80::write_io(uint8_t port_lo, uint8_t port_hi, uint8_t value) {
+	if (accuracy != Accuracy::BusCycle) {
+		devices.write(port_lo, port_hi, value);
 
-		result = operand1 - operand2;
+		return;
+	}
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarry
-			| FlagNames::F3
-			| FlagNames::Overflow
-			| FlagNames::SubtractSet
-			| FlagNames::Carry;
+	wait_next_clock();
 
-		break;
+	update_m_cycle(M_Cycles::IOWrite);
 
-	case Instruction::Names::XOR:
+	address_bus = (static_cast<uint16_t>(port_hi) << 8) | port_lo;
+	data_bus = value;
 
-		result = operand1 ^ operand2;
+	set_bus_pins(0);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::CarryReset;
+	wait_next_clock();
 
-		break;
+	set_bus_pins(PinBits::IORQ | PinBits::WR);
 
-	case Instruction::Names::NONI:
+	wait_next_clock();
 
-		break;
+	set_bus_pins(PinBits::IORQ | PinBits::WR);
 
-	case Instruction::Names::RLCalt:
-	{
-		result = operand2 << 1;
+	wait_next_clock();
 
-		if (operand2 & 0xFFFFFF00) {
-			result |= 1;
-		}
+	set_bus_pins(PinBits::IORQ | PinBits::WR);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
+	devices.write(port_lo, port_hi, value);
+}
 
-		break;
-	}
+void Soft80::bus_acknowledge() {
+	wait_next_clock();
 
-	case Instruction::Names::RRCalt:
-	{
-		result = operand2 >> 1;
+	address_bus = 0;
+	data_bus = 0;
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
+	set_pins(PinBits::BUSACK, true);
 
-		if (operand2 & 1) {
-			result |= 0x80;
+	while (read_busreq()) {
+		wait_next_clock();
 
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
+		if (read_busreq()) {
+			stall(StopReason::BusRequest);
 		}
-
-		break;
 	}
 
-	case Instruction::Names::RLalt:
-	{
-		result = operand2 << 1;
-
-		if (flags.carry) {
-			result |= 1;
-		}
+	set_pins(PinBits::BUSACK, false);
+}
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
+void Soft80::int_acknowledge() {
+	wait_next_clock();
 
-		break;
-	}
+	update_m_cycle(M_Cycles::IntAck);
 
-	case Instruction::Names::RRalt:
-	{
-		result = operand2 >> 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand2 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
+	set_pins(PinBits::HALT, false);
 
-		break;
-	}
+	iff1 = false;
+	iff2 = false;
 
-	case Instruction::Names::SLAalt:
-	{
-		result = operand2 << 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
+	set_pins(PinBits::M1, true);
 
-		break;
-	}
+	wait_next_clock();
+	wait_next_clock();
 
-	case Instruction::Names::SRAalt:
-	{
-		if (operand2 & 0xFFFFFF80) {
-			result = (operand2 | 0xFFFFFF00) >> 1;
-		}
-		else {
-			result = operand2 >> 1;
-		}
+	// A vector placed for an earlier acknowledge is not an answer to this one.
+	set_event(EventBits::VECTOR, false);
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand2 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
+	set_pins(PinBits::IORQ, true);
 
-		break;
+	// The device must see the acknowledge to place its vector, however much
+	// clock is left in the grant. IM 1 reads no vector, but a cooperative
+	// device is still given the chance to see it.
+	if (execution_mode != ExecutionMode::Synchronous && interrupt_mode != 1) {
+		wait_for_vector();
+	}
+	else if (fiber) {
+		fiber->suspend();
 	}
 
-	case Instruction::Names::SLLalt:
-	{
-		result = operand2 << 1;
-
-		result |= 1;
+	wait_next_clock();
+	wait_next_clock();
 
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset
-			| FlagNames::Carry;
+	uint16_t vector = data_bus;
 
+	set_pins(PinBits::M1 | PinBits::IORQ, false);
+	
+	switch (interrupt_mode) {
+	case 0:
+		int_response = true;
+		int_vector = vector;
 		break;
-	}
-
-	case Instruction::Names::SRLalt:
+	case 1:
 	{
-		result = operand2 >> 1;
-
-		out_flags =
-			FlagNames::Sign
-			| FlagNames::Zero
-			| FlagNames::F5
-			| FlagNames::HalfCarryReset
-			| FlagNames::F3
-			| FlagNames::Parity
-			| FlagNames::SubtractReset;
-
-		if (operand2 & 1) {
-			out_flags |= FlagNames::CarrySet;
-		}
-		else {
-			out_flags |= FlagNames::CarryReset;
-		}
+		uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
+		uint8_t PC_low = registers.PC & 0x00FF;
 
-		break;
-	}
+		registers.SP--;
+		write_memory(registers.SP, PC_high);
+		registers.SP--;
+		write_memory(registers.SP, PC_low);
 
-	case Instruction::Names::RESalt:
-	{
-		uint8_t bit = 1 << current_instruction->imm;
-		uint8_t value = (operand2 | bit) ^ bit;
+		registers.PC = 0x0038;
 
-		if (current_instruction->addr_source) {
-			write_memory(source_value, value);
-		}
-		else {
-			registers.set_value(current_instruction->source, value);
-		}
+		charge_untimed_accesses(2);
 
 		break;
 	}
-
-	case Instruction::Names::SETalt:
+	case 2:
 	{
-		uint8_t bit = 1 << current_instruction->imm;
-		uint8_t value = operand2 | bit;
-
-		if (current_instruction->addr_source) {
-			write_memory(source_value, value);
-		}
-		else {
-			registers.set_value(current_instruction->source, value);
-		}
-
-		break;
-	}
-	}
-
-	uint8_t out_flags_value = 0;
-
-	if (is_flag_set(out_flags, FlagNames::Sign)) {
-		bool is_neg = result & 0x00000080;
-
-		if (RegisterFile::is_16bit(current_instruction->dest) && RegisterFile::is_16bit(current_instruction->source)) {
-			is_neg = result & 0x00008000;
-		}
-
-		if (is_neg) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::Sign);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Sign);
-		}
-	}
-
-	if (is_flag_set(out_flags, FlagNames::Zero)) {
-		if (result == 0) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::Zero);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Zero);
-		}
-	}
-
-	if (is_flag_set(out_flags, FlagNames::F5)) {
-		if (result & 0x00000020) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::F5);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::F5);
-		}
-	}
-
-	if (is_flag_set(out_flags, FlagNames::HalfCarry)) {
-		if ((operand1 & 0x00000008) && (operand2 & 0x00000008)) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::HalfCarry);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::HalfCarry);
-		}
-	}
-
-	if (is_flag_set(out_flags, FlagNames::F3)) {
-		if (result & 0x00000008) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::F3);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::F3);
-		}
-	}
-
-	if (is_flag_set(out_flags, FlagNames::Parity)) {
-
-		size_t bit_count = 0;
-
-		for (size_t i = 0; i < 8; i++) {
-			uint8_t bit = 1 << i;
-
-			if (result & bit) {
-				bit_count++;
-			}
-		}
-
-		if (bit_count % 2 == 0) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::Overflow);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Overflow);
-		}
-
-	}
-
-	if (is_flag_set(out_flags, FlagNames::Overflow)) {
-		bool is_overflow = result & 0xFFFFFFFF00;
-
-		if (RegisterFile::is_16bit(current_instruction->dest) && RegisterFile::is_16bit(current_instruction->source)) {
-			is_overflow = result & 0xFFFF0000;
-		}
 
-		if (is_overflow) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::Overflow);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Overflow);
-		}
-	}
+		uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
+		uint8_t PC_low = registers.PC & 0x00FF;
 
-	if (is_flag_set(out_flags, FlagNames::Carry)) {
-		bool is_carry = result & 0xFFFFFF00;
+		registers.SP--;
+		write_memory(registers.SP, PC_high);
+		registers.SP--;
+		write_memory(registers.SP, PC_low);
 
-		if (RegisterFile::is_16bit(current_instruction->dest) && RegisterFile::is_16bit(current_instruction->source)) {
-			is_carry = result & 0xFFFF0000;
-		}
+		uint16_t I = registers.I;
 
-		if (is_carry) {
-			out_flags_value = set_flag_bit(out_flags_value, FlagBits::Carry);
-		}
-		else {
-			out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Carry);
-		}
-	}
+		uint16_t vector_low = (I << 8) | vector;
+		uint16_t vector_high = (I << 8) | (vector + 1);
 
-	if (is_flag_set(out_flags, FlagNames::SignSet)) {
-		out_flags_value = set_flag_bit(out_flags_value, FlagBits::Sign);
-	}
+		uint16_t addr_low = read_memory(vector_low);
+		uint16_t addr_high = read_memory(vector_high);
 
-	if (is_flag_set(out_flags, FlagNames::SignReset)) {
-		out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Sign);
-	}
+		registers.PC = (addr_high << 8) | addr_low;
 
-	if (is_flag_set(out_flags, FlagNames::ZeroSet)) {
-		out_flags_value = set_flag_bit(out_flags_value, FlagBits::Zero);
-	}
+		charge_untimed_accesses(4);
 
-	if (is_flag_set(out_flags, FlagNames::ZeroReset)) {
-		out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Zero);
+		break;
 	}
-
-	if (is_flag_set(out_flags, FlagNames::HalfCarrySet)) {
-		out_flags_value = set_flag_bit(out_flags_value, FlagBits::HalfCarry);
 	}
+}
 
-	if (is_flag_set(out_flags, FlagNames::HalfCarryReset)) {
-		out_flags_value = reset_flag_bit(out_flags_value, FlagBits::HalfCarry);
-	}
+void Soft80::nmi_acknowledge() {
+	wait_next_clock();
 
-	if (is_flag_set(out_flags, FlagNames::OverflowSet)) {
-		out_flags_value = set_flag_bit(out_flags_value, FlagBits::Overflow);
-	}
+	update_m_cycle(M_Cycles::IntAck);
 
-	if (is_flag_set(out_flags, FlagNames::OverflowReset)) {
-		out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Overflow);
-	}
+	set_pins(PinBits::HALT, false);
 
-	if (is_flag_set(out_flags, FlagNames::SubtractSet)) {
-		out_flags_value = set_flag_bit(out_flags_value, FlagBits::Subtract);
-	}
+	iff2 = iff1;
+	iff1 = false;
 
-	if (is_flag_set(out_flags, FlagNames::SubtractReset)) {
-		out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Subtract);
-	}
+	uint8_t PC_high = (registers.PC & 0xFF00) >> 8;
+	uint8_t PC_low = registers.PC & 0x00FF;
 
-	if (is_flag_set(out_flags, FlagNames::CarrySet)) {
-		out_flags_value = set_flag_bit(out_flags_value, FlagBits::Carry);
-	}
+	registers.SP--;
+	write_memory(registers.SP, PC_high);
+	registers.SP--;
+	write_memory(registers.SP, PC_low);
 
-	if (is_flag_set(out_flags, FlagNames::CarryReset)) {
-		out_flags_value = reset_flag_bit(out_flags_value, FlagBits::Carry);
-	}
+	registers.PC = 0x0066;
 
-	registers.main.F = out_flags_value;
+	charge_untimed_accesses(2);
+}
 
-	if (!is_io) {
-		if (current_instruction->addr_dest) {
-			write_memory(dest_value, result);
-		}
-		else {
-			registers.set_value(current_instruction->dest, result);
-		}
+// Memory cycles outside an instruction have no table entry to charge them.
+void Soft80::charge_untimed_accesses(size_t count) {
+	if (accuracy == Accuracy::InstructionCycle) {
+		charge_t_cycles(3 * count);
 	}
-
-	current_instruction = std::nullopt;
 }
 
 void Soft80::update_m_cycle(M_Cycles next_cycle) {
@@ -2399,31 +1412,13 @@ void Soft80::update_m_cycle(M_Cycles next_cycle) {
 }
 
 bool Soft80::read_busreq() {
-	for (auto b : busreq_sources) {
-		if (*b) {
-			return true;
-		}
-	}
-
-	return false;
+	return pending_events.load(std::memory_order_acquire) & EventBits::BUSREQ;
 }
 
 bool Soft80::read_reset() {
-	for (auto b : reset_sources) {
-		if (*b) {
-			return true;
-		}
-	}
-
-	return false;
+	return pending_events.load(std::memory_order_acquire) & EventBits::RESET;
 }
 
 bool Soft80::read_wait() {
-	for (auto b : wait_sources) {
-		if (*b) {
-			return true;
-		}
-	}
-
-	return false;
+	return pending_events.load(std::memory_order_acquire) & EventBits::WAIT;
 }
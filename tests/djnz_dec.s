@@ -0,0 +1,8 @@
+MAIN:
+	LD B, 5
+	LD C, 3
+LOOP:
+	DEC C
+	DJNZ LOOP
+	
+	HALT
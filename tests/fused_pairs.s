@@ -0,0 +1,25 @@
+MAIN:
+	LD SP, 0FFF0H
+	LD BC, 0050H
+	NOP
+	NOP
+	LD E, 41H
+	OUT (C), E
+	LD H, 3
+	DEC H
+	PUSH BC
+	PUSH HL
+	POP DE
+	POP HL
+	LD D, 4
+LOOP:
+	NOP
+	DEC D
+	JP NZ, LOOP
+	LD D, 2
+	NOP
+	DEC D
+	JR NZ, DONE
+	HALT
+DONE:
+	HALT
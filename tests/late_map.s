@@ -0,0 +1,4 @@
+MAIN:
+	LD A, ($9000)
+	LD B, A
+	JP MAIN